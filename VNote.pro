@@ -13,3 +13,10 @@ SUBDIRS = hoedown \
     src
 
 src.depends = hoedown peg-highlight
+
+# The benchmark compiles all the sources of src again, so it is only built
+# with "qmake CONFIG+=benchmark".
+CONFIG(benchmark) {
+    SUBDIRS += benchmark
+    benchmark.depends = hoedown peg-highlight
+}
@@ -0,0 +1,64 @@
+# Headless benchmark of the Markdown editor.
+# Build it with "qmake CONFIG+=benchmark" at the top level.
+# Run it with QT_QPA_PLATFORM=offscreen (the default of it).
+
+QT       += core gui webenginewidgets webchannel network svg printsupport
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = vnote-benchmark
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+SRC_DIR = $$PWD/../src
+
+SOURCES += main.cpp \
+    vcorpusgenerator.cpp
+
+HEADERS += vcorpusgenerator.h
+
+# All the sources of VNote except its main().
+SOURCES += $$files($$SRC_DIR/*.cpp) \
+    $$files($$SRC_DIR/dialog/*.cpp) \
+    $$SRC_DIR/utils/vutils.cpp
+SOURCES -= $$SRC_DIR/main.cpp
+
+HEADERS += $$files($$SRC_DIR/*.h) \
+    $$files($$SRC_DIR/dialog/*.h) \
+    $$SRC_DIR/utils/vutils.h
+
+INCLUDEPATH += $$SRC_DIR
+
+RESOURCES += $$SRC_DIR/vnote.qrc
+
+macx {
+    LIBS += -L/usr/local/lib
+    INCLUDEPATH += /usr/local/include
+}
+
+windows {
+    DEFINES *= Q_COMPILER_INITIALIZER_LISTS
+    LIBS += -lpsapi
+}
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../hoedown/release/ -lhoedown
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../hoedown/debug/ -lhoedown
+else:unix: LIBS += -L$$OUT_PWD/../hoedown/ -lhoedown
+
+INCLUDEPATH += $$PWD/../hoedown
+DEPENDPATH += $$PWD/../hoedown
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../peg-highlight/release/ -lpeg-highlight
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../peg-highlight/debug/ -lpeg-highlight
+else:unix: LIBS += -L$$OUT_PWD/../peg-highlight/ -lpeg-highlight
+
+INCLUDEPATH += $$PWD/../peg-highlight
+DEPENDPATH += $$PWD/../peg-highlight
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/release/libpeg-highlight.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/debug/libpeg-highlight.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/release/peg-highlight.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/debug/peg-highlight.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/libpeg-highlight.a
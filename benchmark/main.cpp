@@ -0,0 +1,580 @@
+// Headless benchmark of the hot paths of the Markdown editor.
+//
+// Usage: vnote-benchmark [--sizes SIZE[,SIZE...]] [--output FILE]
+//   --sizes: sizes in bytes of the generated Markdown text. Defaults to
+//            10 KB, 100 KB, 1 MB, 5 MB and 20 MB.
+//   --output: write the JSON report to FILE instead of the standard output.
+//
+// It runs on the offscreen platform unless QT_QPA_PLATFORM is set.
+// It exits with 1 if the parallel parse differs from the serial one.
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegExp>
+#include <QStringList>
+#include <QTextDocument>
+#include <QThread>
+#include <QTimer>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "vconfigmanager.h"
+#include "vnote.h"
+#include "vorphanfile.h"
+#include "vdocument.h"
+#include "vmdedit.h"
+#include "vcodeblockhighlightservice.h"
+#include "hgmarkdownhighlighter.h"
+#include "hgmarkdownparser.h"
+#include "hgmarkdownscanner.h"
+#include "hgparallelparser.h"
+#include "hgcodeblocktokenizer.h"
+#include "vcorpusgenerator.h"
+
+VConfigManager vconfig;
+extern VNote *g_vnote;
+
+// Time out of waiting for the editor, in ms.
+static const int c_waitTimeout = 10 * 60 * 1000;
+
+// Peak resident set size of the process in KB.
+static qint64 peakRss()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return pmc.PeakWorkingSetSize / 1024;
+    }
+
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+
+#if defined(Q_OS_MAC)
+    // In bytes on macOS.
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static double toMs(qint64 p_nsecs)
+{
+    return p_nsecs / 1000000.0;
+}
+
+// Run the event loop until @p_signal of @p_sender is emitted.
+// Return false on time out.
+template <typename Func>
+static bool waitForSignal(const typename QtPrivate::FunctionPointer<Func>::Object *p_sender,
+                          Func p_signal)
+{
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout,
+                     &loop, [&loop]() { loop.exit(1); });
+    QObject::connect(p_sender, p_signal,
+                     &loop, [&loop]() { loop.exit(0); });
+    timer.start(c_waitTimeout);
+    return loop.exec() == 0;
+}
+
+static void appendEscapedHtml(QString &p_html, const QString &p_text)
+{
+    for (auto ch : p_text) {
+        if (ch == '&') {
+            p_html.append("&amp;");
+        } else if (ch == '<') {
+            p_html.append("&lt;");
+        } else if (ch == '>') {
+            p_html.append("&gt;");
+        } else {
+            p_html.append(ch);
+        }
+    }
+}
+
+static void appendSpan(QString &p_html, const QString &p_class, const QString &p_text)
+{
+    p_html.append("<span class=\"" + p_class + "\">");
+    appendEscapedHtml(p_html, p_text);
+    p_html.append("</span>");
+}
+
+// Simulate highlight.js in the web side. Highlight keywords, numbers and
+// strings of fenced code block @p_text.
+static QString fakeHighlight(const QString &p_text)
+{
+    static const QStringList keywords = QStringList() << "int" << "char" << "return"
+                                                      << "def" << "for" << "in"
+                                                      << "if" << "do" << "done"
+                                                      << "func" << "echo";
+
+    QStringList lines = p_text.split('\n');
+    QString html("<pre><code>");
+    // Skip the fences.
+    for (int i = 1; i < lines.size() - 1; ++i) {
+        const QString &line = lines[i];
+        int j = 0;
+        while (j < line.size()) {
+            QChar ch = line[j];
+            int k = j + 1;
+            if (ch.isLetter() || ch == '_') {
+                while (k < line.size() && (line[k].isLetterOrNumber() || line[k] == '_')) {
+                    ++k;
+                }
+
+                QString word = line.mid(j, k - j);
+                if (keywords.contains(word)) {
+                    appendSpan(html, "hljs-keyword", word);
+                } else {
+                    appendEscapedHtml(html, word);
+                }
+            } else if (ch.isDigit()) {
+                while (k < line.size() && line[k].isDigit()) {
+                    ++k;
+                }
+
+                appendSpan(html, "hljs-number", line.mid(j, k - j));
+            } else if (ch == '"' || ch == '\'') {
+                while (k < line.size() && line[k] != ch) {
+                    ++k;
+                }
+
+                k = qMin(k + 1, line.size());
+                appendSpan(html, "hljs-string", line.mid(j, k - j));
+            } else {
+                appendEscapedHtml(html, QString(ch));
+            }
+
+            j = k;
+        }
+
+        html.append('\n');
+    }
+
+    html.append("</code></pre>\n");
+    return html;
+}
+
+// Count fenced code blocks and links with spaces in URL with the QRegExp
+// used before HGMarkdownScanner.
+static int regExpScan(const QStringList &p_lines)
+{
+    QRegExp codeBlockStartExp("^\\s*```(\\S*)");
+    QRegExp codeBlockEndExp("^\\s*```$");
+    int nrFound = 0;
+    bool inBlock = false;
+    for (auto const &line : p_lines) {
+        if (inBlock) {
+            if (codeBlockEndExp.indexIn(line) >= 0) {
+                inBlock = false;
+                ++nrFound;
+            }
+        } else if (codeBlockStartExp.indexIn(line) >= 0) {
+            inBlock = true;
+        } else {
+            QRegExp regExp("[\\!]?\\[[^\\]]*\\]\\(([^\\n\\)]+)\\)");
+            int index = regExp.indexIn(line);
+            while (index >= 0) {
+                int length = regExp.matchedLength();
+                if (regExp.capturedTexts()[1].contains(' ')) {
+                    ++nrFound;
+                }
+
+                index = regExp.indexIn(line, index + length);
+            }
+        }
+    }
+
+    return nrFound;
+}
+
+static int scannerScan(const QStringList &p_lines)
+{
+    HGBlockScanResult scan;
+    int nrFound = 0;
+    bool inBlock = false;
+    for (auto const &line : p_lines) {
+        HGMarkdownScanner::scanBlock(line, inBlock, true, scan);
+        if (inBlock && scan.m_fence == HGBlockScanResult::FenceEnd) {
+            ++nrFound;
+        }
+
+        nrFound += scan.m_links.size();
+        inBlock = HGMarkdownScanner::continuesCodeBlock(scan, inBlock);
+    }
+
+    return nrFound;
+}
+
+static QJsonObject benchParser(const QString &p_text)
+{
+    QJsonObject obj;
+    QElapsedTimer timer;
+
+    // PEG Markdown Highlight only.
+    QByteArray data = p_text.toUtf8();
+    char *buffer = NULL;
+    size_t bufferSize = 0;
+    pmh_element **elements = NULL;
+    timer.start();
+    pmh_markdown_to_elements_len(data.constData(), data.size(), pmh_EXT_NONE,
+                                 &buffer, &bufferSize, &elements);
+    obj["pmh_parse_ms"] = toMs(timer.nsecsElapsed());
+
+    // Elements and strings used to be malloc'ed one by one; now they are
+    // served by a few arena blocks.
+    size_t nrAllocs = 0, nrBlocks = 0;
+    pmh_get_allocation_stats(elements, &nrAllocs, &nrBlocks);
+    obj["pmh_allocs"] = (qint64)nrAllocs;
+    obj["pmh_system_allocs"] = (qint64)nrBlocks;
+
+    timer.restart();
+    pmh_free_elements(elements);
+    obj["pmh_free_ms"] = toMs(timer.nsecsElapsed());
+    free(buffer);
+
+    // Parse again with a context warmed by the first parse, like the
+    // highlighter does.
+    pmh_context *context = pmh_context_create();
+    pmh_context_parse(context, data.constData(), data.size(), pmh_EXT_NONE,
+                      &elements);
+    timer.restart();
+    pmh_context_parse(context, data.constData(), data.size(), pmh_EXT_NONE,
+                      &elements);
+    obj["pmh_warm_parse_ms"] = toMs(timer.nsecsElapsed());
+    pmh_get_allocation_stats(elements, &nrAllocs, &nrBlocks);
+    obj["pmh_warm_system_allocs"] = (qint64)nrBlocks;
+
+    // Parse the UTF-16 text without transcoding, like the highlighter does.
+    timer.restart();
+    pmh_context_parse_utf16(context, p_text.utf16(), p_text.size(), pmh_EXT_NONE,
+                            &elements);
+    obj["pmh_utf16_parse_ms"] = toMs(timer.nsecsElapsed());
+
+    // Parse in chunks concurrently, and check the merged elements against
+    // the ones of the parse above. Split even small text to check it.
+    HGParallelParser parallelParser;
+    pmh_element **parallelElements = NULL;
+    int maxChunks = qMax(QThread::idealThreadCount(), 2);
+    parallelParser.parse(p_text, maxChunks, &parallelElements);
+    timer.restart();
+    parallelParser.parse(p_text, maxChunks, &parallelElements);
+    obj["pmh_parallel_parse_ms"] = toMs(timer.nsecsElapsed());
+    obj["pmh_parallel_chunks"] = parallelParser.numOfChunks();
+    obj["pmh_parallel_matches"] = HGParallelParser::sameElements(elements, parallelElements);
+    pmh_context_destroy(context);
+
+    // The parser used by the highlighter, including mapping to blocks.
+    HGMarkdownParser parser(vconfig.getMdHighlightingStyles());
+    HGParseRequest req;
+    req.m_timeStamp = 1;
+    req.m_text = p_text;
+    parser.invalidate(req.m_timeStamp);
+    parser.requestParse(req);
+    HGParseResult res;
+    if (waitForSignal(&parser, &HGMarkdownParser::parseFinished)
+        && parser.takeResult(res)) {
+        obj["parse_ms"] = res.m_parseTime / 1000.0;
+        obj["block_mapping_ms"] = res.m_mapTime / 1000.0;
+        obj["blocks"] = res.m_numOfBlocks;
+    }
+
+    // Scan of fences and links.
+    QStringList lines = p_text.split('\n');
+    timer.restart();
+    int nrFound = regExpScan(lines);
+    obj["regexp_scan_ms"] = toMs(timer.nsecsElapsed());
+    timer.restart();
+    int nrScanned = scannerScan(lines);
+    obj["scanner_ms"] = toMs(timer.nsecsElapsed());
+    obj["scanner_matches_regexp"] = nrFound == nrScanned;
+
+    return obj;
+}
+
+// Parse time in ms of @p_data with @p_context.
+static double timeParse(pmh_context *p_context, const QByteArray &p_data)
+{
+    QElapsedTimer timer;
+    pmh_element **elements = NULL;
+    timer.start();
+    pmh_context_parse(p_context, p_data.constData(), p_data.size(), pmh_EXT_NONE,
+                      &elements);
+    return toMs(timer.nsecsElapsed());
+}
+
+// Deadline of a parse in benchPathological().
+struct ParseDeadline
+{
+    QElapsedTimer m_timer;
+    double m_maxMs;
+};
+
+static int isPastDeadline(void *p_deadline)
+{
+    const ParseDeadline *deadline = static_cast<const ParseDeadline *>(p_deadline);
+    return toMs(deadline->m_timer.nsecsElapsed()) > deadline->m_maxMs;
+}
+
+// Parse pathological inputs of growing depth with and without memoizing the
+// expensive rules. Without memo, a parse is cancelled once it takes longer
+// than @p_maxMs and deeper inputs are skipped, since the time grows
+// exponentially.
+static QJsonArray benchPathological(const QList<int> &p_depths, double p_maxMs)
+{
+    QJsonArray results;
+    ParseDeadline deadline;
+    deadline.m_maxMs = p_maxMs;
+    pmh_context *plain = pmh_context_create();
+    pmh_context_set_cancel(plain, &isPastDeadline, &deadline, 0);
+    pmh_context *memo = pmh_context_create();
+    pmh_context_set_memo(memo, pmh_MEMO_HTML_BLOCKS | pmh_MEMO_EMPHASIS,
+                         HGMarkdownParser::c_memoSize);
+
+    for (int i = 0; i < VCorpusGenerator::NrOfPathologies; ++i) {
+        VCorpusGenerator::Pathology pathology = (VCorpusGenerator::Pathology)i;
+        bool skipPlain = false;
+        for (int depth : p_depths) {
+            QByteArray data = VCorpusGenerator::generatePathological(pathology, depth).toUtf8();
+            QJsonObject obj;
+            obj["pathology"] = VCorpusGenerator::pathologyName(pathology);
+            obj["depth"] = depth;
+            obj["size"] = data.size();
+
+            if (!skipPlain) {
+                pmh_element **elements = NULL;
+                deadline.m_timer.start();
+                pmh_parse_status status = pmh_context_parse(plain, data.constData(),
+                                                            data.size(), pmh_EXT_NONE,
+                                                            &elements);
+                double ms = toMs(deadline.m_timer.nsecsElapsed());
+                if (status == pmh_PARSE_CANCELLED) {
+                    obj["parse_timed_out_ms"] = ms;
+                    skipPlain = true;
+                } else {
+                    obj["parse_ms"] = ms;
+                }
+            }
+
+            obj["memo_parse_ms"] = timeParse(memo, data);
+            size_t hits = 0, misses = 0;
+            pmh_context_get_memo_stats(memo, &hits, &misses);
+            obj["memo_hits"] = (qint64)hits;
+            obj["memo_misses"] = (qint64)misses;
+            results.append(obj);
+        }
+    }
+
+    pmh_context_destroy(plain);
+    pmh_context_destroy(memo);
+    return results;
+}
+
+static void benchEditor(const QString &p_text, QJsonObject &p_obj)
+{
+    VOrphanFile file("vnote-benchmark.md", NULL);
+
+    // Play the web side of the code block highlight service, which is ready
+    // at once.
+    VDocument *vdoc = g_vnote->getCodeBlockHighlightService()->findChild<VDocument *>();
+    Q_ASSERT(vdoc);
+    vdoc->noticeReadyToHighlightText();
+
+    // Batches of requests to highlight code blocks sent to the web side.
+    struct HighlightRequest
+    {
+        QJsonArray m_texts;
+        int m_timeStamp;
+    };
+
+    // Disconnect from the service on return.
+    QObject context;
+    QVector<HighlightRequest> requests;
+    QObject::connect(vdoc, &VDocument::requestHighlightTexts, &context,
+                     [&requests](const QJsonArray &p_texts, int p_timeStamp) {
+                         HighlightRequest req;
+                         req.m_texts = p_texts;
+                         req.m_timeStamp = p_timeStamp;
+                         requests.append(req);
+                     });
+
+    VMdEdit edit(&file);
+    edit.resize(800, 600);
+    edit.show();
+
+    HGMarkdownHighlighter *highlighter = edit.document()->findChild<HGMarkdownHighlighter *>();
+    Q_ASSERT(highlighter);
+
+    // Code blocks to highlight, either natively or by the web side.
+    QList<VCodeBlock> codeBlocks;
+    QObject::connect(highlighter, &HGMarkdownHighlighter::codeBlocksUpdated,
+                     [&codeBlocks](const QList<VCodeBlock> &p_codeBlocks) {
+                         codeBlocks = p_codeBlocks;
+                     });
+
+    QElapsedTimer timer;
+    timer.start();
+    edit.setPlainText(p_text);
+    p_obj["set_text_ms"] = toMs(timer.nsecsElapsed());
+
+    highlighter->updateHighlight();
+    if (!waitForSignal(highlighter, &HGMarkdownHighlighter::highlightCompleted)) {
+        p_obj["error"] = QString("timed out waiting for the highlighter");
+        return;
+    }
+
+    // Results of code blocks from the web side, one array for each batch.
+    qint64 codeBlockTime = 0;
+    int nrRequested = 0;
+    // Results of a batch may trigger the next one.
+    for (int i = 0; i < requests.size(); ++i) {
+        const HighlightRequest req = requests[i];
+        QJsonArray results;
+        for (auto const &val : req.m_texts) {
+            QJsonObject text = val.toObject();
+            QJsonObject result;
+            result["id"] = text["id"];
+            result["html"] = fakeHighlight(text["text"].toString());
+            results.append(result);
+        }
+
+        nrRequested += req.m_texts.size();
+        timer.restart();
+        vdoc->highlightTextsCB(results, req.m_timeStamp);
+        codeBlockTime += timer.nsecsElapsed();
+    }
+
+    p_obj["code_blocks"] = nrRequested;
+    p_obj["code_block_batches"] = requests.size();
+    p_obj["code_block_highlight_ms"] = toMs(codeBlockTime);
+
+    // Code blocks tokenized natively, which have been highlighted along with
+    // the parse above.
+    int nrNative = 0;
+    QList<HLUnitPos> units;
+    timer.restart();
+    for (auto const &block : codeBlocks) {
+        units.clear();
+        if (HGCodeBlockTokenizer::tokenize(block, units)) {
+            ++nrNative;
+        }
+    }
+
+    p_obj["native_code_blocks"] = nrNative;
+    p_obj["native_tokenize_ms"] = toMs(timer.nsecsElapsed());
+
+    timer.restart();
+    highlighter->rehighlight();
+    p_obj["rehighlight_ms"] = toMs(timer.nsecsElapsed());
+
+    timer.restart();
+    QMetaObject::invokeMethod(&edit, "generateEditOutline");
+    p_obj["outline_ms"] = toMs(timer.nsecsElapsed());
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+
+    QCommandLineParser cmdParser;
+    cmdParser.addHelpOption();
+    QCommandLineOption sizesOpt("sizes", "Sizes in bytes of the generated text.", "sizes",
+                                "10240,102400,1048576,5242880,20971520");
+    QCommandLineOption outputOpt("output", "Write the report to <file>.", "file");
+    QCommandLineOption depthsOpt("depths", "Depths of the pathological inputs.", "depths",
+                                 "5,10,20,40,80,160,320");
+    cmdParser.addOption(sizesOpt);
+    cmdParser.addOption(outputOpt);
+    cmdParser.addOption(depthsOpt);
+    cmdParser.process(app);
+
+    vconfig.initialize();
+    g_vnote = new VNote(NULL);
+
+    // Exit status. Fail if the parallel parse differs from the serial one.
+    int ret = 0;
+    QJsonArray results;
+    QStringList sizes = cmdParser.value(sizesOpt).split(',', QString::SkipEmptyParts);
+    for (auto const &sizeStr : sizes) {
+        int size = sizeStr.toInt();
+        if (size <= 0) {
+            fprintf(stderr, "invalid size %s\n", sizeStr.toUtf8().constData());
+            return 1;
+        }
+
+        VCorpusGenerator generator;
+        QString text = generator.generate(size);
+
+        QJsonObject obj = benchParser(text);
+        if (!obj["pmh_parallel_matches"].toBool()) {
+            fprintf(stderr, "parallel parse of size %d differs from serial parse\n", size);
+            ret = 1;
+        }
+
+        obj["size"] = text.toUtf8().size();
+        obj["chars"] = text.size();
+        benchEditor(text, obj);
+
+        // Peak of the whole process so far. Sizes are usually ascending.
+        obj["peak_rss_kb"] = peakRss();
+        results.append(obj);
+    }
+
+    QList<int> depths;
+    QStringList depthStrs = cmdParser.value(depthsOpt).split(',', QString::SkipEmptyParts);
+    for (auto const &depthStr : depthStrs) {
+        int depth = depthStr.toInt();
+        if (depth <= 0) {
+            fprintf(stderr, "invalid depth %s\n", depthStr.toUtf8().constData());
+            return 1;
+        }
+
+        depths.append(depth);
+    }
+
+    QJsonObject root;
+    root["qt_version"] = QString(qVersion());
+    root["code_block_highlight"] = vconfig.getEnableCodeBlockHighlight();
+    root["results"] = results;
+    root["pathological"] = benchPathological(depths, 2000);
+    QByteArray json = QJsonDocument(root).toJson();
+
+    if (cmdParser.isSet(outputOpt)) {
+        QFile file(cmdParser.value(outputOpt));
+        if (!file.open(QIODevice::WriteOnly)) {
+            fprintf(stderr, "fail to open %s\n", file.fileName().toUtf8().constData());
+            return 1;
+        }
+
+        file.write(json);
+    } else {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    delete g_vnote;
+    g_vnote = NULL;
+    return ret;
+}
@@ -0,0 +1,247 @@
+#include "vcorpusgenerator.h"
+
+VCorpusGenerator::VCorpusGenerator(quint32 p_seed)
+    : m_state(p_seed), m_nrReferences(0)
+{
+    m_words << "note" << "markdown" << "editor" << "highlight" << "block"
+            << "vnote" << "document" << "parse" << "preview" << "outline"
+            << "heading" << "folder" << "image" << "link" << "table"
+            << "the" << "a" << "of" << "with" << "and" << "to" << "in"
+            << QString::fromUtf8("笔记") << QString::fromUtf8("编辑器")
+            << QString::fromUtf8("naïve") << QString::fromUtf8("café");
+
+    m_languages << "cpp" << "python" << "bash" << "json" << "" << "go";
+
+    m_codeLines << "int main(int argc, char *argv[])"
+                << "{"
+                << "    return a.exec();"
+                << "}"
+                << "def parse(text, ext=None):"
+                << "    return [x for x in text.split('\\n') if x]"
+                << "for f in *.md; do echo \"$f\"; done"
+                << "{\"name\": \"vnote\", \"version\": 1, \"tags\": [\"a\", \"b\"]}"
+                << "func main() { fmt.Println(\"hello <world> & co\") }"
+                << "    // A comment with `backticks` and *stars*.";
+}
+
+quint32 VCorpusGenerator::next()
+{
+    m_state = m_state * 1103515245u + 12345u;
+    return m_state >> 8;
+}
+
+int VCorpusGenerator::nextInt(int p_max)
+{
+    return next() % p_max;
+}
+
+const QString &VCorpusGenerator::pick(const QStringList &p_list)
+{
+    return p_list[nextInt(p_list.size())];
+}
+
+QString VCorpusGenerator::sentence(int p_minWords, int p_maxWords)
+{
+    QString str;
+    int nrWords = p_minWords + nextInt(p_maxWords - p_minWords + 1);
+    for (int i = 0; i < nrWords; ++i) {
+        if (i > 0) {
+            str.append(' ');
+        }
+
+        const QString &word = pick(m_words);
+        switch (nextInt(16)) {
+        case 0:
+            str.append("*" + word + "*");
+            break;
+
+        case 1:
+            str.append("**" + word + "**");
+            break;
+
+        case 2:
+            str.append("`" + word + "`");
+            break;
+
+        case 3:
+            str.append("[" + word + "](https://github.com/tamlok/vnote)");
+            break;
+
+        case 4:
+            str.append("[" + word + "][ref" + QString::number(m_nrReferences++) + "]");
+            break;
+
+        case 5:
+            // Link with spaces in URL.
+            str.append("[" + word + "](notes/" + word + " copy.md)");
+            break;
+
+        default:
+            str.append(word);
+            break;
+        }
+    }
+
+    return str;
+}
+
+void VCorpusGenerator::appendHeading(QString &p_text)
+{
+    p_text.append(QString(1 + nextInt(6), '#'));
+    p_text.append(' ');
+    p_text.append(sentence(1, 6));
+    p_text.append("\n\n");
+}
+
+void VCorpusGenerator::appendParagraph(QString &p_text)
+{
+    int nrLines = 1 + nextInt(4);
+    for (int i = 0; i < nrLines; ++i) {
+        p_text.append(sentence(5, 20));
+        p_text.append('\n');
+    }
+
+    p_text.append('\n');
+}
+
+void VCorpusGenerator::appendList(QString &p_text)
+{
+    bool ordered = nextInt(2) == 0;
+    int nrItems = 2 + nextInt(6);
+    for (int i = 0; i < nrItems; ++i) {
+        int indent = nextInt(3) == 0 ? 4 : 0;
+        p_text.append(QString(indent, ' '));
+        if (ordered) {
+            p_text.append(QString("%1. ").arg(i + 1));
+        } else {
+            p_text.append("* ");
+        }
+
+        p_text.append(sentence(3, 12));
+        p_text.append('\n');
+    }
+
+    p_text.append('\n');
+}
+
+void VCorpusGenerator::appendCodeBlock(QString &p_text)
+{
+    // Indented fence inside a list from time to time.
+    QString indent = nextInt(4) == 0 ? "    " : "";
+    p_text.append(indent + "```" + pick(m_languages) + "\n");
+    int nrLines = 2 + nextInt(20);
+    for (int i = 0; i < nrLines; ++i) {
+        p_text.append(indent + pick(m_codeLines) + "\n");
+    }
+
+    p_text.append(indent + "```\n\n");
+}
+
+void VCorpusGenerator::appendComment(QString &p_text)
+{
+    if (nextInt(2) == 0) {
+        p_text.append("<!-- " + sentence(2, 8) + " -->\n\n");
+    } else {
+        p_text.append("<!--\n");
+        int nrLines = 1 + nextInt(5);
+        for (int i = 0; i < nrLines; ++i) {
+            p_text.append(sentence(2, 10) + "\n");
+        }
+
+        p_text.append("-->\n\n");
+    }
+}
+
+void VCorpusGenerator::appendQuote(QString &p_text)
+{
+    int nrLines = 1 + nextInt(3);
+    for (int i = 0; i < nrLines; ++i) {
+        p_text.append("> " + sentence(4, 12) + "\n");
+    }
+
+    p_text.append('\n');
+}
+
+void VCorpusGenerator::appendImage(QString &p_text)
+{
+    const QString &word = pick(m_words);
+    if (nextInt(2) == 0) {
+        p_text.append("![" + word + "](_v_images/" + word + ".png)\n\n");
+    } else {
+        p_text.append("![" + word + "](_v_images/" + word + " 1.png)\n\n");
+    }
+}
+
+QString VCorpusGenerator::generate(int p_size)
+{
+    QString text;
+    text.reserve(p_size + 1024);
+    while (text.size() < p_size) {
+        int kind = nextInt(20);
+        if (kind < 2) {
+            appendHeading(text);
+        } else if (kind < 9) {
+            appendParagraph(text);
+        } else if (kind < 12) {
+            appendList(text);
+        } else if (kind < 15) {
+            appendCodeBlock(text);
+        } else if (kind < 17) {
+            appendComment(text);
+        } else if (kind < 18) {
+            appendQuote(text);
+        } else {
+            appendImage(text);
+        }
+    }
+
+    // Reference definitions.
+    for (int i = 0; i < m_nrReferences; i += 7) {
+        text.append(QString("[ref%1]: https://github.com/tamlok/vnote \"VNote\"\n").arg(i));
+    }
+
+    return text;
+}
+
+QString VCorpusGenerator::pathologyName(Pathology p_pathology)
+{
+    switch (p_pathology) {
+    case UnclosedHtml:
+        return "unclosed_html";
+
+    case UnclosedTables:
+        return "unclosed_tables";
+
+    case UnclosedEmphasis:
+        return "unclosed_emphasis";
+
+    default:
+        return QString();
+    }
+}
+
+QString VCorpusGenerator::generatePathological(Pathology p_pathology, int p_depth)
+{
+    QString text("\n");
+    for (int i = 0; i < p_depth; ++i) {
+        switch (p_pathology) {
+        case UnclosedHtml:
+            text.append("<div>\n");
+            break;
+
+        case UnclosedTables:
+            text.append("<table><tr><td>");
+            break;
+
+        case UnclosedEmphasis:
+            text.append("*a **b _c __d ");
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    text.append("text\n\n");
+    return text;
+}
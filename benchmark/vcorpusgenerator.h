@@ -0,0 +1,63 @@
+#ifndef VCORPUSGENERATOR_H
+#define VCORPUSGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+
+// Generate Markdown text mixing headings, paragraphs, lists, fenced code
+// blocks, HTML comments, quotes, links and images.
+// The same seed always generates the same text.
+class VCorpusGenerator
+{
+public:
+    explicit VCorpusGenerator(quint32 p_seed = 1);
+
+    // Generate text of about @p_size UTF-16 characters.
+    QString generate(int p_size);
+
+    // Inputs making the parser backtrack a lot.
+    enum Pathology
+    {
+        // Nested HTML blocks which are never closed.
+        UnclosedHtml = 0,
+        // Nested tables in HTML blocks which are never closed.
+        UnclosedTables,
+        // Emphasis and strong markers which are never closed.
+        UnclosedEmphasis,
+        NrOfPathologies
+    };
+
+    static QString pathologyName(Pathology p_pathology);
+
+    // Generate text of @p_pathology nested or repeated @p_depth times.
+    static QString generatePathological(Pathology p_pathology, int p_depth);
+
+private:
+    // A simple LCG to be independent of qrand().
+    quint32 next();
+
+    int nextInt(int p_max);
+
+    const QString &pick(const QStringList &p_list);
+
+    QString sentence(int p_minWords, int p_maxWords);
+
+    void appendHeading(QString &p_text);
+    void appendParagraph(QString &p_text);
+    void appendList(QString &p_text);
+    void appendCodeBlock(QString &p_text);
+    void appendComment(QString &p_text);
+    void appendQuote(QString &p_text);
+    void appendImage(QString &p_text);
+
+    quint32 m_state;
+
+    // Number of reference links used.
+    int m_nrReferences;
+
+    QStringList m_words;
+    QStringList m_languages;
+    QStringList m_codeLines;
+};
+
+#endif // VCORPUSGENERATOR_H
@@ -90,16 +90,293 @@ typedef struct pmh_RealElement pmh_realelement;
 
 
 
+// Size of the memory blocks of an arena:
+#define pmh_ARENA_BLOCK_SIZE (64 * 1024)
+
+// Alignment of the memory allocated from an arena:
+#define pmh_ARENA_ALIGN (2 * sizeof(void *))
+
+#define pmh_ARENA_ROUND_UP(x) (((x) + pmh_ARENA_ALIGN - 1) & ~(pmh_ARENA_ALIGN - 1))
+
+// A memory block of an arena. The memory to allocate from follows the
+// header.
+typedef struct pmh_ArenaBlock
+{
+    struct pmh_ArenaBlock *next;
+    size_t size;
+    size_t used;
+} pmh_arena_block;
+
+#define pmh_ARENA_BLOCK_DATA(b) \
+    ((char *)(b) + pmh_ARENA_ROUND_UP(sizeof(pmh_arena_block)))
+
+// Bump-pointer allocator of the elements and strings of a parsing result.
+// Memory allocated from it is only freed all at once.
+typedef struct
+{
+    /* The block to allocate from, followed by the full ones: */
+    pmh_arena_block *head;
+    
+    /* Empty blocks kept by arena_reset() for reuse: */
+    pmh_arena_block *spare;
+    
+    /* Statistics: */
+    size_t num_allocs;
+    size_t num_blocks;
+} pmh_arena;
+
+static void *arena_alloc(pmh_arena *arena, size_t size)
+{
+    size = pmh_ARENA_ROUND_UP(size);
+    arena->num_allocs++;
+    
+    pmh_arena_block *block = arena->head;
+    if (block == NULL || block->used + size > block->size)
+    {
+        if (size <= pmh_ARENA_BLOCK_SIZE && arena->spare != NULL) {
+            block = arena->spare;
+            arena->spare = block->next;
+        } else {
+            size_t block_size = (size > pmh_ARENA_BLOCK_SIZE)
+                                ? size : pmh_ARENA_BLOCK_SIZE;
+            block = (pmh_arena_block *)
+                    malloc(pmh_ARENA_ROUND_UP(sizeof(pmh_arena_block)) + block_size);
+            block->size = block_size;
+            arena->num_blocks++;
+        }
+        block->used = 0;
+        
+        if (arena->head != NULL && size > pmh_ARENA_BLOCK_SIZE) {
+            // Keep allocating from current block.
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+    
+    void *ret = pmh_ARENA_BLOCK_DATA(block) + block->used;
+    block->used += size;
+    return ret;
+}
+
+// Free all the memory allocated from the arena, keeping the blocks of
+// standard size for reuse.
+static void arena_reset(pmh_arena *arena)
+{
+    pmh_arena_block *block = arena->head;
+    while (block != NULL) {
+        pmh_arena_block *next = block->next;
+        if (block->size == pmh_ARENA_BLOCK_SIZE) {
+            block->next = arena->spare;
+            arena->spare = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    arena->head = NULL;
+    arena->num_allocs = 0;
+    arena->num_blocks = 0;
+}
+
+static void free_block_list(pmh_arena_block *block)
+{
+    while (block != NULL) {
+        pmh_arena_block *tofree = block;
+        block = block->next;
+        free(tofree);
+    }
+}
+
+static void arena_free_all(pmh_arena *arena)
+{
+    free_block_list(arena->head);
+    free_block_list(arena->spare);
+    arena->head = NULL;
+    arena->spare = NULL;
+}
+
+
+// The parsing result. The array of element lists returned to the caller
+// is its first member, so the result could be found from it.
+typedef struct
+{
+    pmh_realelement *head_elems[pmh_NUM_TYPES];
+    
+    /* Where the elements and strings in head_elems are allocated: */
+    pmh_arena arena;
+} pmh_result;
+
+
+// A run of bytes stripped from the original input. `pos` is the offset in
+// the preformatted text where the bytes have been stripped, and `total` is
+// the number of bytes stripped up to and including the run.
+typedef struct
+{
+    unsigned long pos;
+    unsigned long total;
+} pmh_strip_run;
+
+// Growable array of strip runs, sorted by pos. Bytes stripped at the same
+// pos always go into one run.
+typedef struct
+{
+    pmh_strip_run *runs;
+    size_t len;
+    size_t size;
+} pmh_strip_runs;
+
+
+// Index of a list of spans for fix_offsets(). spans[i] is the i-th span,
+// offsets[i] is the total length of the spans before it and
+// previous_ends[i] is the end of the last pmh_RAW span before it (or 0).
+// Each array has an extra entry for the end of the list.
+typedef struct
+{
+    /* The list indexed, or NULL if the index is not built yet: */
+    pmh_realelement *head;
+    
+    pmh_realelement **spans;
+    unsigned long *offsets;
+    unsigned long *previous_ends;
+    size_t num_spans;
+    size_t capacity;
+} pmh_span_index;
+
+
+// An entry of the memo table. Entries of an older generation are empty.
+typedef struct
+{
+    unsigned int generation;
+    short rule;
+    
+    /* Whether the call changed begin and end of the parser state: */
+    short sets_text;
+    
+    /* Position the rule was called at, and where it stopped, or -1 if it */
+    /* failed: */
+    int pos;
+    int end;
+    
+    /* begin and end of the parser state after the call, if sets_text: */
+    int text_begin;
+    int text_end;
+} pmh_memo_entry;
+
+// Memo of the results of expensive rules by (rule, position). It is a
+// direct-mapped table, so a new entry simply replaces the one in its slot.
+typedef struct
+{
+    /* Groups of rules to memoize (a bitfield of pmh_memo_rules values): */
+    int rules;
+    
+    /* Memory cap of the table in bytes: */
+    size_t max_bytes;
+    
+    pmh_memo_entry *entries;
+    size_t mask;
+    
+    /* Generation of current (sub)parse: */
+    unsigned int generation;
+    
+    /* Statistics: */
+    size_t hits;
+    size_t misses;
+} pmh_memo;
+
+
+// Buffers kept across parses by a context.
+struct pmh_Context
+{
+    /* Buffer of the text to parse, see strcpy_preformat(): */
+    char *buffer;
+    size_t buffer_size;
+    
+    /* Bytes stripped from the input: */
+    pmh_strip_runs strip_runs;
+    
+    /* The span to parse for the whole document: */
+    pmh_realelement parsing_elem;
+    
+    /* Span index, shared by the parser data of a parse since (sub)parses */
+    /* run one after another: */
+    pmh_span_index span_index;
+    
+    /* The original UTF-16 input of current parse, or NULL if the input is */
+    /* UTF-8: */
+    const unsigned short *utf16_input;
+    
+    /* State of the greg parser, reused by all (sub)parses: */
+    struct _GREG *greg;
+    
+    /* Memo of rules, disabled by default: */
+    pmh_memo memo;
+    
+    /* Cancellation of a parse, see continue_parse(): */
+    pmh_cancel_callback cancel_callback;
+    void *cancel_data;
+    unsigned long step_budget;
+    
+    /* Match steps taken by current parse, and the step count at which */
+    /* to call continue_parse() next: */
+    unsigned long steps;
+    unsigned long next_check;
+    
+    /* Whether current parse has been cancelled: */
+    bool cancelled;
+    
+    /* Result of the last parse, or NULL: */
+    pmh_result *result;
+};
+
+// Number of match steps between two calls of the cancel callback.
+#define pmh_CANCEL_CHECK_INTERVAL 4096
+
+// Called every pmh_CANCEL_CHECK_INTERVAL steps of a parse. Return false if
+// the parse is cancelled, in which case all later matches fail so that the
+// parser unwinds quickly.
+static bool continue_parse(pmh_context *context)
+{
+    if (context->cancelled)
+        return false;
+    
+    if (context->step_budget > 0 && context->steps >= context->step_budget) {
+        context->cancelled = true;
+        return false;
+    }
+    
+    if (context->cancel_callback != NULL
+        && context->cancel_callback(context->cancel_data)) {
+        context->cancelled = true;
+        return false;
+    }
+    
+    if (context->cancel_callback == NULL && context->step_budget == 0) {
+        context->next_check = (unsigned long)-1;
+        return true;
+    }
+    
+    context->next_check = context->steps + pmh_CANCEL_CHECK_INTERVAL;
+    if (context->step_budget > 0 && context->next_check > context->step_budget)
+        context->next_check = context->step_budget;
+    return true;
+}
+
+
+
 
 // Parser state data:
 typedef struct
 {
-    /* The original, unmodified UTF-8 input: */
-    char *original_input;
+    /* The original, unmodified UTF-8 input, or NULL if the input is */
+    /* UTF-16 (see pmh_context::utf16_input): */
+    const char *original_input;
     
-    /* The offsets of the bytes we have stripped from original_input: */
-    unsigned long *strip_positions;
-    size_t strip_positions_len;
+    /* The bytes we have stripped from original_input: */
+    const pmh_strip_run *strip_runs;
+    size_t strip_runs_len;
     
     /* Buffer of characters to be parsed: */
     char *charbuf;
@@ -109,6 +386,13 @@ typedef struct
     pmh_realelement *current_elem;
     pmh_realelement *elem_head;
     
+    /* Context providing the buffers: */
+    pmh_context *context;
+    
+    /* Number of reads of the parser which got no input although there */
+    /* is more input after (the end of a pmh_EXTRA_TEXT span or a NUL): */
+    unsigned long num_failed_reads;
+    
     /* Current parsing offset within charbuf: */
     unsigned long offset;
     
@@ -119,6 +403,9 @@ typedef struct
     /* Array of parsing result elements, indexed by type: */
     pmh_realelement **head_elems;
     
+    /* Arena of the parsing result: */
+    pmh_arena *arena;
+    
     /* Whether we are parsing only references: */
     bool parsing_only_references;
     
@@ -126,36 +413,33 @@ typedef struct
     pmh_realelement *references;
 } parser_data;
 
-static parser_data *mk_parser_data(char *original_input,
-                                   unsigned long *strip_positions,
-                                   size_t strip_positions_len,
-                                   char *charbuf,
-                                   pmh_realelement *parsing_elems,
-                                   unsigned long offset,
-                                   int extensions,
-                                   pmh_realelement **head_elems,
-                                   pmh_realelement *references)
+static void init_parser_data(parser_data *p_data,
+                             pmh_context *context,
+                             const char *original_input,
+                             const pmh_strip_run *strip_runs,
+                             size_t strip_runs_len,
+                             char *charbuf,
+                             pmh_realelement *parsing_elems,
+                             unsigned long offset,
+                             int extensions,
+                             pmh_result *result,
+                             pmh_realelement *references)
 {
-    parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
+    p_data->context = context;
+    p_data->num_failed_reads = 0;
     p_data->extensions = extensions;
     p_data->original_input = original_input;
-    p_data->strip_positions = strip_positions;
-    p_data->strip_positions_len = strip_positions_len;
+    p_data->strip_runs = strip_runs;
+    p_data->strip_runs_len = strip_runs_len;
     p_data->charbuf = charbuf;
     p_data->offset = offset;
     p_data->elem_head = p_data->current_elem = parsing_elems;
+    // The span index belongs to the previous parser data.
+    context->span_index.head = NULL;
     p_data->references = references;
     p_data->parsing_only_references = false;
-    if (head_elems != NULL)
-        p_data->head_elems = head_elems;
-    else {
-        p_data->head_elems = (pmh_realelement **)
-                             malloc(sizeof(pmh_realelement *) * pmh_NUM_TYPES);
-        int i;
-        for (i = 0; i < pmh_NUM_TYPES; i++)
-            p_data->head_elems[i] = NULL;
-    }
-    return p_data;
+    p_data->head_elems = result->head_elems;
+    p_data->arena = &result->arena;
 }
 
 
@@ -312,7 +596,8 @@ iteratively until no such elements exist.
 static void process_raw_blocks(parser_data *p_data)
 {
     pmh_PRINTF("--------process_raw_blocks---------\n");
-    while (p_data->head_elems[pmh_RAW_LIST] != NULL)
+    while (p_data->head_elems[pmh_RAW_LIST] != NULL
+           && !p_data->context->cancelled)
     {
         pmh_PRINTF("new iteration.\n");
         pmh_realelement *cursor = p_data->head_elems[pmh_RAW_LIST];
@@ -360,19 +645,21 @@ static void process_raw_blocks(parser_data *p_data)
                 #endif
                 
                 // Process subspan_list:
-                parser_data *raw_p_data = mk_parser_data(
+                parser_data raw_p_data;
+                init_parser_data(
+                    &raw_p_data,
+                    p_data->context,
                     p_data->original_input,
-                    p_data->strip_positions,
-                    p_data->strip_positions_len,
+                    p_data->strip_runs,
+                    p_data->strip_runs_len,
                     p_data->charbuf,
                     subspan_list,
                     subspan_list->pos,
                     p_data->extensions,
-                    p_data->head_elems,
+                    (pmh_result *)p_data->head_elems,
                     p_data->references
                 );
-                parse_markdown(raw_p_data);
-                free(raw_p_data);
+                parse_markdown(&raw_p_data);
                 
                 pmh_PRINTF("parse over\n");
             }
@@ -403,21 +690,18 @@ static void print_raw_blocks(char *text, pmh_realelement *elem[])
 /* Free all elements created while parsing */
 void pmh_free_elements(pmh_element **elems)
 {
-    pmh_realelement *cursor = (pmh_realelement*)elems[pmh_ALL];
-    while (cursor != NULL) {
-        pmh_realelement *tofree = cursor;
-        cursor = cursor->all_elems_next;
-        if (tofree->text != NULL)
-            free(tofree->text);
-        if (tofree->label != NULL)
-            free(tofree->label);
-        if (tofree->address != NULL)
-            free(tofree->address);
-        free(tofree);
-    }
-    elems[pmh_ALL] = NULL;
-    
-    free(elems);
+    // All the elements and their strings are in the arena.
+    pmh_result *result = (pmh_result *)elems;
+    arena_free_all(&result->arena);
+    free(result);
+}
+
+void pmh_get_allocation_stats(pmh_element **elems,
+                              size_t *num_allocs, size_t *num_blocks)
+{
+    pmh_result *result = (pmh_result *)elems;
+    *num_allocs = result->arena.num_allocs;
+    *num_blocks = result->arena.num_blocks;
 }
 
 
@@ -426,131 +710,893 @@ void pmh_free_elements(pmh_element **elems)
 
 
 #define IS_CONTINUATION_BYTE(x) ((x & 0xC0) == 0x80)
-#define HAS_UTF8_BOM(x)         ( ((*x & 0xFF) == 0xEF)\
+#define HAS_UTF8_BOM(x, len)    ( (len) >= 3\
+                                  && ((*x & 0xFF) == 0xEF)\
                                   && ((*(x+1) & 0xFF) == 0xBB)\
                                   && ((*(x+2) & 0xFF) == 0xBF) )
-#define ADD_STRIP_POS(x) \
-    /* reallocate more space for the array, if needed: */ \
-    if (strip_positions_size <= strip_positions_pos) { \
-        size_t new_size = strip_positions_size * 2; \
-        unsigned long *new_arr = (unsigned long *) \
-                                 calloc(new_size, \
-                                        sizeof(unsigned long)); \
-        memcpy(new_arr, strip_positions, \
-               (sizeof(unsigned long) * strip_positions_size)); \
-        strip_positions_size = new_size; \
-        free(strip_positions); \
-        strip_positions = new_arr; \
-    } \
-    strip_positions[strip_positions_pos] = x; \
-    strip_positions_pos++;
+// Record `count` bytes stripped at offset `pos` of the preformatted text.
+static inline void add_strip_run(pmh_strip_runs *runs, unsigned long pos,
+                          unsigned long count)
+{
+    if (runs->len > 0 && runs->runs[runs->len - 1].pos == pos) {
+        runs->runs[runs->len - 1].total += count;
+        return;
+    }
+    
+    if (runs->len == runs->size) {
+        runs->size = (runs->size == 0) ? 1024 : runs->size * 2;
+        runs->runs = (pmh_strip_run *)realloc(runs->runs,
+                                              sizeof(pmh_strip_run) * runs->size);
+    }
+    
+    unsigned long total = (runs->len > 0) ? runs->runs[runs->len - 1].total : 0;
+    runs->runs[runs->len].pos = pos;
+    runs->runs[runs->len].total = total + count;
+    runs->len++;
+}
+
+static inline unsigned int count_trailing_zeros(unsigned int x)
+{
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return idx;
+#elif defined(__GNUC__)
+    return __builtin_ctz(x);
+#else
+    unsigned int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline unsigned int count_bits(unsigned int x)
+{
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return (x * 0x01010101u) >> 24;
+}
+
+// Record the runs of continuation bytes marked by the bits of `mask`, which
+// covers `len` (at most 32) bytes copied to offset `base`.
+static inline void add_strip_runs_of_mask(unsigned int mask, unsigned int len,
+                                          size_t base, pmh_strip_runs *runs)
+{
+    unsigned int starts = mask & ~(mask << 1);
+    while (starts != 0)
+    {
+        unsigned int j = count_trailing_zeros(starts);
+        unsigned int before = count_bits(mask & ((1u << j) - 1));
+        unsigned int rest = ~(mask >> j);
+        unsigned int count = (rest == 0) ? len - j : count_trailing_zeros(rest);
+        add_strip_run(runs, base + j - before, count);
+        starts &= starts - 1;
+    }
+}
+
+// Copy `len` (at most 32) bytes of `src` to `out + *i`, skipping the
+// continuation bytes, which are marked by the bits of `mask`.
+static inline void compact_chunk(const char *src, unsigned int len,
+                                 unsigned int mask, char *out, size_t *i,
+                                 pmh_strip_runs *runs)
+{
+    // Copy every byte without branches; a continuation byte is overwritten
+    // by the next byte.
+    size_t base = *i;
+    size_t k = base;
+    unsigned int j;
+    for (j = 0; j < len; j++)
+    {
+        out[k] = src[j];
+        k += ((mask >> j) & 1) ^ 1;
+    }
+    *i = k;
+    
+    add_strip_runs_of_mask(mask, len, base, runs);
+}
+
+// Copy `len` bytes of `str` to `out`, skipping the continuation bytes.
+// Return the number of bytes copied.
+typedef size_t (*pmh_compact_func)(const char *str, size_t len, char *out,
+                                   pmh_strip_runs *runs);
+
+// Copy `len` bytes of `src` to `out + *i` one by one, skipping the
+// continuation bytes.
+static void compact_bytes(const char *src, size_t len, char *out, size_t *i,
+                          pmh_strip_runs *runs)
+{
+    size_t j;
+    for (j = 0; j < len; j++)
+    {
+        if (!IS_CONTINUATION_BYTE(src[j]))
+            out[(*i)++] = src[j];
+        else
+            add_strip_run(runs, *i, 1);
+    }
+}
+
+static size_t compact_scalar(const char *str, size_t len, char *out,
+                             pmh_strip_runs *runs)
+{
+    size_t i = 0;
+    compact_bytes(str, len, out, &i, runs);
+    return i;
+}
+
+// SSE2 and AVX2 versions find the continuation bytes of 16 or 32 bytes at
+// once, and copy chunks without any of them in one store:
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define pmh_X86_SIMD 1
+#define pmh_TARGET_SSE2 __attribute__((target("sse2")))
+#define pmh_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define pmh_X86_SIMD 1
+#define pmh_TARGET_SSE2
+#define pmh_TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef pmh_X86_SIMD
+pmh_TARGET_SSE2
+static size_t compact_sse2(const char *str, size_t len, char *out,
+                           pmh_strip_runs *runs)
+{
+    // Continuation bytes are 0x80 - 0xBF, i.e. less than -64 as signed.
+    const __m128i limit = _mm_set1_epi8(-64);
+    size_t i = 0;
+    size_t j = 0;
+    for (; j + 16 <= len; j += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(str + j));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)(out + i), v);
+            i += 16;
+        } else {
+            compact_chunk(str + j, 16, mask, out, &i, runs);
+        }
+    }
+    
+    compact_bytes(str + j, len - j, out, &i, runs);
+    return i;
+}
+
+// For each mask of continuation bytes in 8 bytes, the shuffle moving the
+// other bytes to the front (0x80 clears a byte), and the number of them.
+// Constant so that parses on several threads could read them at once.
+static const unsigned char compact_shuffles[256][8] = {
+    {0, 1, 2, 3, 4, 5, 6, 7},
+    {1, 2, 3, 4, 5, 6, 7, 0x80},
+    {0, 2, 3, 4, 5, 6, 7, 0x80},
+    {2, 3, 4, 5, 6, 7, 0x80, 0x80},
+    {0, 1, 3, 4, 5, 6, 7, 0x80},
+    {1, 3, 4, 5, 6, 7, 0x80, 0x80},
+    {0, 3, 4, 5, 6, 7, 0x80, 0x80},
+    {3, 4, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 5, 6, 7, 0x80},
+    {1, 2, 4, 5, 6, 7, 0x80, 0x80},
+    {0, 2, 4, 5, 6, 7, 0x80, 0x80},
+    {2, 4, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 1, 4, 5, 6, 7, 0x80, 0x80},
+    {1, 4, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 4, 5, 6, 7, 0x80, 0x80, 0x80},
+    {4, 5, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 5, 6, 7, 0x80},
+    {1, 2, 3, 5, 6, 7, 0x80, 0x80},
+    {0, 2, 3, 5, 6, 7, 0x80, 0x80},
+    {2, 3, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 1, 3, 5, 6, 7, 0x80, 0x80},
+    {1, 3, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 3, 5, 6, 7, 0x80, 0x80, 0x80},
+    {3, 5, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 5, 6, 7, 0x80, 0x80},
+    {1, 2, 5, 6, 7, 0x80, 0x80, 0x80},
+    {0, 2, 5, 6, 7, 0x80, 0x80, 0x80},
+    {2, 5, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 5, 6, 7, 0x80, 0x80, 0x80},
+    {1, 5, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 5, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {5, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 6, 7, 0x80},
+    {1, 2, 3, 4, 6, 7, 0x80, 0x80},
+    {0, 2, 3, 4, 6, 7, 0x80, 0x80},
+    {2, 3, 4, 6, 7, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 6, 7, 0x80, 0x80},
+    {1, 3, 4, 6, 7, 0x80, 0x80, 0x80},
+    {0, 3, 4, 6, 7, 0x80, 0x80, 0x80},
+    {3, 4, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 6, 7, 0x80, 0x80},
+    {1, 2, 4, 6, 7, 0x80, 0x80, 0x80},
+    {0, 2, 4, 6, 7, 0x80, 0x80, 0x80},
+    {2, 4, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 6, 7, 0x80, 0x80, 0x80},
+    {1, 4, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {4, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 6, 7, 0x80, 0x80},
+    {1, 2, 3, 6, 7, 0x80, 0x80, 0x80},
+    {0, 2, 3, 6, 7, 0x80, 0x80, 0x80},
+    {2, 3, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 6, 7, 0x80, 0x80, 0x80},
+    {1, 3, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {3, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 6, 7, 0x80, 0x80, 0x80},
+    {1, 2, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {2, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 6, 7, 0x80, 0x80, 0x80, 0x80},
+    {1, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {6, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 5, 7, 0x80},
+    {1, 2, 3, 4, 5, 7, 0x80, 0x80},
+    {0, 2, 3, 4, 5, 7, 0x80, 0x80},
+    {2, 3, 4, 5, 7, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 5, 7, 0x80, 0x80},
+    {1, 3, 4, 5, 7, 0x80, 0x80, 0x80},
+    {0, 3, 4, 5, 7, 0x80, 0x80, 0x80},
+    {3, 4, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 5, 7, 0x80, 0x80},
+    {1, 2, 4, 5, 7, 0x80, 0x80, 0x80},
+    {0, 2, 4, 5, 7, 0x80, 0x80, 0x80},
+    {2, 4, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 5, 7, 0x80, 0x80, 0x80},
+    {1, 4, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {4, 5, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 5, 7, 0x80, 0x80},
+    {1, 2, 3, 5, 7, 0x80, 0x80, 0x80},
+    {0, 2, 3, 5, 7, 0x80, 0x80, 0x80},
+    {2, 3, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 5, 7, 0x80, 0x80, 0x80},
+    {1, 3, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {3, 5, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 5, 7, 0x80, 0x80, 0x80},
+    {1, 2, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {2, 5, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 5, 7, 0x80, 0x80, 0x80, 0x80},
+    {1, 5, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 5, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {5, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 7, 0x80, 0x80},
+    {1, 2, 3, 4, 7, 0x80, 0x80, 0x80},
+    {0, 2, 3, 4, 7, 0x80, 0x80, 0x80},
+    {2, 3, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 7, 0x80, 0x80, 0x80},
+    {1, 3, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {3, 4, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 7, 0x80, 0x80, 0x80},
+    {1, 2, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {2, 4, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 7, 0x80, 0x80, 0x80, 0x80},
+    {1, 4, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {4, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 7, 0x80, 0x80, 0x80},
+    {1, 2, 3, 7, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 3, 7, 0x80, 0x80, 0x80, 0x80},
+    {2, 3, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 7, 0x80, 0x80, 0x80, 0x80},
+    {1, 3, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {3, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 7, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 7, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 5, 6, 0x80},
+    {1, 2, 3, 4, 5, 6, 0x80, 0x80},
+    {0, 2, 3, 4, 5, 6, 0x80, 0x80},
+    {2, 3, 4, 5, 6, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 5, 6, 0x80, 0x80},
+    {1, 3, 4, 5, 6, 0x80, 0x80, 0x80},
+    {0, 3, 4, 5, 6, 0x80, 0x80, 0x80},
+    {3, 4, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 5, 6, 0x80, 0x80},
+    {1, 2, 4, 5, 6, 0x80, 0x80, 0x80},
+    {0, 2, 4, 5, 6, 0x80, 0x80, 0x80},
+    {2, 4, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 5, 6, 0x80, 0x80, 0x80},
+    {1, 4, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {4, 5, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 5, 6, 0x80, 0x80},
+    {1, 2, 3, 5, 6, 0x80, 0x80, 0x80},
+    {0, 2, 3, 5, 6, 0x80, 0x80, 0x80},
+    {2, 3, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 5, 6, 0x80, 0x80, 0x80},
+    {1, 3, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {3, 5, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 5, 6, 0x80, 0x80, 0x80},
+    {1, 2, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {2, 5, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 5, 6, 0x80, 0x80, 0x80, 0x80},
+    {1, 5, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 5, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {5, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 6, 0x80, 0x80},
+    {1, 2, 3, 4, 6, 0x80, 0x80, 0x80},
+    {0, 2, 3, 4, 6, 0x80, 0x80, 0x80},
+    {2, 3, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 6, 0x80, 0x80, 0x80},
+    {1, 3, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {3, 4, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 6, 0x80, 0x80, 0x80},
+    {1, 2, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {2, 4, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 6, 0x80, 0x80, 0x80, 0x80},
+    {1, 4, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {4, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 6, 0x80, 0x80, 0x80},
+    {1, 2, 3, 6, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 3, 6, 0x80, 0x80, 0x80, 0x80},
+    {2, 3, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 6, 0x80, 0x80, 0x80, 0x80},
+    {1, 3, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {3, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 6, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 6, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {6, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 5, 0x80, 0x80},
+    {1, 2, 3, 4, 5, 0x80, 0x80, 0x80},
+    {0, 2, 3, 4, 5, 0x80, 0x80, 0x80},
+    {2, 3, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 5, 0x80, 0x80, 0x80},
+    {1, 3, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {3, 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 5, 0x80, 0x80, 0x80},
+    {1, 2, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {2, 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 5, 0x80, 0x80, 0x80, 0x80},
+    {1, 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {4, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 5, 0x80, 0x80, 0x80},
+    {1, 2, 3, 5, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 3, 5, 0x80, 0x80, 0x80, 0x80},
+    {2, 3, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 5, 0x80, 0x80, 0x80, 0x80},
+    {1, 3, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {3, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 5, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 5, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 4, 0x80, 0x80, 0x80},
+    {1, 2, 3, 4, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 3, 4, 0x80, 0x80, 0x80, 0x80},
+    {2, 3, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 4, 0x80, 0x80, 0x80, 0x80},
+    {1, 3, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {3, 4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 4, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 4, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {4, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 3, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 3, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 3, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 3, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 2, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 2, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 2, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {2, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80}
+};
+
+static const unsigned char compact_lengths[256] = {
+    8, 7, 7, 6, 7, 6, 6, 5, 7, 6, 6, 5, 6, 5, 5, 4,
+    7, 6, 6, 5, 6, 5, 5, 4, 6, 5, 5, 4, 5, 4, 4, 3,
+    7, 6, 6, 5, 6, 5, 5, 4, 6, 5, 5, 4, 5, 4, 4, 3,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    7, 6, 6, 5, 6, 5, 5, 4, 6, 5, 5, 4, 5, 4, 4, 3,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    5, 4, 4, 3, 4, 3, 3, 2, 4, 3, 3, 2, 3, 2, 2, 1,
+    7, 6, 6, 5, 6, 5, 5, 4, 6, 5, 5, 4, 5, 4, 4, 3,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    5, 4, 4, 3, 4, 3, 3, 2, 4, 3, 3, 2, 3, 2, 2, 1,
+    6, 5, 5, 4, 5, 4, 4, 3, 5, 4, 4, 3, 4, 3, 3, 2,
+    5, 4, 4, 3, 4, 3, 3, 2, 4, 3, 3, 2, 3, 2, 2, 1,
+    5, 4, 4, 3, 4, 3, 3, 2, 4, 3, 3, 2, 3, 2, 2, 1,
+    4, 3, 3, 2, 3, 2, 2, 1, 3, 2, 2, 1, 2, 1, 1, 0
+};
+
+pmh_TARGET_AVX2
+static size_t compact_avx2(const char *str, size_t len, char *out,
+                           pmh_strip_runs *runs)
+{
+    const __m256i limit = _mm256_set1_epi8(-64);
+    size_t i = 0;
+    size_t j = 0;
+    for (; j + 32 <= len; j += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(str + j));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+                                _mm256_cmpgt_epi8(limit, v));
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)(out + i), v);
+            i += 32;
+            continue;
+        }
+        
+        // Compact 8 bytes at a time with a shuffle.
+        size_t base = i;
+        int g;
+        for (g = 0; g < 4; g++)
+        {
+            unsigned int m = (mask >> (g * 8)) & 0xFF;
+            __m128i bytes = _mm_loadl_epi64((const __m128i *)(str + j + g * 8));
+            __m128i shuffle = _mm_loadl_epi64((const __m128i *)compact_shuffles[m]);
+            _mm_storel_epi64((__m128i *)(out + i), _mm_shuffle_epi8(bytes, shuffle));
+            i += compact_lengths[m];
+        }
+        add_strip_runs_of_mask(mask, 32, base, runs);
+    }
+    
+    compact_bytes(str + j, len - j, out, &i, runs);
+    return i;
+}
+
+static bool cpu_has_sse2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    // AVX2 needs the OS to save the YMM registers.
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// The compaction picked by get_compact_func(), which could be called by
+// parses on several threads at once. They may all pick it, but always the
+// same one, so the pointer only needs atomic accesses.
+static pmh_compact_func compact_func = NULL;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define pmh_LOAD_COMPACT_FUNC()     __atomic_load_n(&compact_func, __ATOMIC_ACQUIRE)
+#define pmh_STORE_COMPACT_FUNC(f)   __atomic_store_n(&compact_func, (f), __ATOMIC_RELEASE)
+#else
+// MSVC makes the accesses of an aligned volatile pointer atomic.
+#define pmh_LOAD_COMPACT_FUNC()     (*(pmh_compact_func volatile *)&compact_func)
+#define pmh_STORE_COMPACT_FUNC(f)   (*(pmh_compact_func volatile *)&compact_func = (f))
+#endif
+
+// Pick the fastest compaction the CPU supports, once.
+static pmh_compact_func get_compact_func()
+{
+    pmh_compact_func func = pmh_LOAD_COMPACT_FUNC();
+    if (func == NULL)
+    {
+        func = compact_scalar;
+        #ifdef pmh_X86_SIMD
+        if (cpu_has_avx2())
+            func = compact_avx2;
+        else if (cpu_has_sse2())
+            func = compact_sse2;
+        #endif
+        pmh_STORE_COMPACT_FUNC(func);
+    }
+    return func;
+}
 
 /*
-Copy `str` to `out`, while doing the following:
+Copy `len` bytes of `str` to `*out`, while doing the following:
   - remove UTF-8 continuation bytes
   - remove possible UTF-8 BOM (byte order mark)
   - append two newlines to the end (like peg-markdown does)
-  - keep track of which bytes we have stripped (in strip_positions)
+  - keep track of which bytes we have stripped (in strip_runs)
+`*out` is a buffer of `*out_size` bytes, which will be reallocated if it is
+too small.
 */
-static int strcpy_preformat(char *str, char **out,
-                            unsigned long **out_strip_positions,
-                            size_t *out_strip_positions_len)
-{
-    size_t strip_positions_size = 1024;
-    size_t strip_positions_pos = 0;
-    unsigned long *strip_positions = (unsigned long *)
-                                     calloc(strip_positions_size,
-                                            sizeof(unsigned long));
-    
+static int strcpy_preformat(const char *str, size_t len,
+                            char **out, size_t *out_size,
+                            pmh_strip_runs *strip_runs)
+{
+    strip_runs->len = 0;
     
     // +2 in the following is due to the "\n\n" suffix:
-    char *new_str = (char *)malloc(sizeof(char) * strlen(str) + 1 + 2);
-    char *c = str;
-    int i = 0;
-    
-    if (HAS_UTF8_BOM(c)) {
-        c += 3;
-        ADD_STRIP_POS(0);
-        ADD_STRIP_POS(1);
-        ADD_STRIP_POS(2);
+    size_t needed_size = sizeof(char) * len + 1 + 2;
+    if (*out == NULL || *out_size < needed_size) {
+        free(*out);
+        *out = (char *)malloc(needed_size);
+        *out_size = needed_size;
     }
+    char *new_str = *out;
+    size_t i = 0;
     
-    while (*c != '\0')
-    {
-        if (!IS_CONTINUATION_BYTE(*c)) {
-            *(new_str+i) = *c, i++;
-        } else {
-            ADD_STRIP_POS((int)(c-str));
-        }
-        c++;
+    if (HAS_UTF8_BOM(str, len)) {
+        add_strip_run(strip_runs, 0, 3);
+        str += 3;
+        len -= 3;
     }
     
+    i = get_compact_func()(str, len, new_str, strip_runs);
+    
     *(new_str+(i++)) = '\n';
     *(new_str+(i++)) = '\n';
     *(new_str+i) = '\0';
     
-    *out = new_str;
-    *out_strip_positions = strip_positions;
-    *out_strip_positions_len = strip_positions_pos;
-    return i;
+    return (int)i;
+}
+
+// Copy UTF-16 `str` of `len` code units to the parser buffer like
+// strcpy_preformat(), one byte per code unit so that the offsets of
+// elements are in code units. A non-ASCII code unit becomes the UTF-8 lead
+// byte of its character, and the low surrogate of a pair a continuation
+// byte, which the parser sees as parts of a word like the UTF-8 bytes.
+static int strcpy_preformat_utf16(const unsigned short *str, size_t len,
+                                  char **out, size_t *out_size,
+                                  pmh_strip_runs *strip_runs)
+{
+    strip_runs->len = 0;
+    
+    size_t needed_size = sizeof(char) * len + 1 + 2;
+    if (*out == NULL || *out_size < needed_size) {
+        free(*out);
+        *out = (char *)malloc(needed_size);
+        *out_size = needed_size;
+    }
+    char *new_str = *out;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        unsigned short c = str[i];
+        if (c < 0x80)
+            new_str[i] = (char)c;
+        else if (c < 0x800)
+            new_str[i] = (char)(0xC0 | (c >> 6));
+        else if (c >= 0xDC00 && c <= 0xDFFF)
+            new_str[i] = (char)0x80;
+        else if (c >= 0xD800 && c <= 0xDBFF)
+            new_str[i] = (char)0xF0;
+        else
+            new_str[i] = (char)(0xE0 | (c >> 12));
+    }
+    
+    new_str[i++] = '\n';
+    new_str[i++] = '\n';
+    new_str[i] = '\0';
+    
+    return (int)i;
 }
 
 
+// Defined after the parser code:
+static void free_greg(pmh_context *context);
 
-void pmh_markdown_to_elements(char *text, int extensions,
-                              pmh_element **out_result[])
+// Parse `len` bytes of UTF-8 `text`, or `len` code units of `utf16` if it is
+// not NULL, into `result`, using the buffers of `context`.
+// If `only_references` is true, stop after the reference definitions are
+// collected and put them into result->head_elems[pmh_REFERENCE].
+// Return false if the parse is cancelled, leaving partial elements in
+// `result`.
+static bool parse_with_context(pmh_context *context,
+                               const char *text, const unsigned short *utf16,
+                               size_t len, int extensions,
+                               bool only_references, pmh_result *result)
 {
-    char *text_copy = NULL;
-    unsigned long *strip_positions = NULL;
-    size_t strip_positions_len = 0;
-    int text_copy_len = strcpy_preformat(text, &text_copy, &strip_positions,
-                                         &strip_positions_len);
+    context->steps = 0;
+    context->next_check = 0;
+    context->cancelled = false;
+    context->utf16_input = utf16;
     
-    pmh_realelement *parsing_elem = (pmh_realelement *)
-                                    malloc(sizeof(pmh_realelement));
+    int text_copy_len;
+    if (utf16 != NULL)
+        text_copy_len = strcpy_preformat_utf16(utf16, len,
+                                               &context->buffer,
+                                               &context->buffer_size,
+                                               &context->strip_runs);
+    else
+        text_copy_len = strcpy_preformat(text, len,
+                                         &context->buffer,
+                                         &context->buffer_size,
+                                         &context->strip_runs);
+    char *text_copy = context->buffer;
+    
+    pmh_realelement *parsing_elem = &context->parsing_elem;
+    memset(parsing_elem, 0, sizeof(*parsing_elem));
     parsing_elem->type = pmh_RAW;
     parsing_elem->pos = 0;
     parsing_elem->end = text_copy_len;
     parsing_elem->next = NULL;
     
-    parser_data *p_data = mk_parser_data(
+    parser_data p_data;
+    init_parser_data(
+        &p_data,
+        context,
         text,
-        strip_positions,
-        strip_positions_len,
+        context->strip_runs.runs,
+        context->strip_runs.len,
         text_copy,
         parsing_elem,
         0,
         extensions,
-        NULL,
+        result,
         NULL
     );
-    pmh_realelement **result = p_data->head_elems;
     
     if (*text_copy != '\0')
     {
-        // Get reference definitions into p_data->references
-        parse_references(p_data);
+        // Get reference definitions into p_data.references
+        parse_references(&p_data);
+        
+        if (only_references) {
+            result->head_elems[pmh_REFERENCE] = p_data.references;
+            return !context->cancelled;
+        }
         
         // Reset parser state to beginning of input
-        p_data->offset = 0;
-        p_data->current_elem = p_data->elem_head;
+        p_data.offset = 0;
+        p_data.current_elem = p_data.elem_head;
         
         // Parse whole document
-        parse_markdown(p_data);
+        parse_markdown(&p_data);
         
         #if pmh_DEBUG_OUTPUT
-        print_raw_blocks(text_copy, result);
+        print_raw_blocks(text_copy, result->head_elems);
         #endif
         
-        process_raw_blocks(p_data);
+        process_raw_blocks(&p_data);
     }
     
-    free(strip_positions);
-    free(p_data);
-    free(parsing_elem);
+    return !context->cancelled;
+}
+
+void pmh_markdown_to_elements(char *text, int extensions,
+                              pmh_element **out_result[])
+{
+    char *text_copy = NULL;
+    size_t text_copy_size = 0;
+    pmh_markdown_to_elements_len(text, strlen(text), extensions,
+                                 &text_copy, &text_copy_size, out_result);
     free(text_copy);
+}
+
+void pmh_markdown_to_elements_len(const char *text, size_t len, int extensions,
+                                  char **buffer, size_t *buffer_size,
+                                  pmh_element **out_result[])
+{
+    // A context for this parse only, using the buffer of the caller.
+    pmh_context context;
+    memset(&context, 0, sizeof(context));
+    context.buffer = *buffer;
+    context.buffer_size = *buffer_size;
+    
+    pmh_result *result = (pmh_result *)calloc(1, sizeof(pmh_result));
+    parse_with_context(&context, text, NULL, len, extensions, false, result);
+    
+    *buffer = context.buffer;
+    *buffer_size = context.buffer_size;
+    context.buffer = NULL;
+    context.buffer_size = 0;
+    pmh_context_reset(&context);
+    
+    *out_result = (pmh_element**)result->head_elems;
+}
+
+pmh_context *pmh_context_create()
+{
+    return (pmh_context *)calloc(1, sizeof(pmh_context));
+}
+
+// Reuse the result of `context` for a new parse.
+static pmh_result *prepare_context_result(pmh_context *context)
+{
+    pmh_result *result = context->result;
+    if (result == NULL) {
+        result = (pmh_result *)calloc(1, sizeof(pmh_result));
+        context->result = result;
+    } else {
+        arena_reset(&result->arena);
+        memset(result->head_elems, 0, sizeof(result->head_elems));
+    }
+    context->memo.hits = 0;
+    context->memo.misses = 0;
+    return result;
+}
+
+// Parse UTF-8 `text` or UTF-16 `utf16` with `context` for the public API.
+static pmh_parse_status context_parse(pmh_context *context,
+                                      const char *text,
+                                      const unsigned short *utf16,
+                                      size_t len, int extensions,
+                                      pmh_element **out_result[])
+{
+    pmh_result *result = prepare_context_result(context);
+    if (!parse_with_context(context, text, utf16, len, extensions, false,
+                            result)) {
+        // Drop the partial elements, keeping the memory warm.
+        arena_reset(&result->arena);
+        memset(result->head_elems, 0, sizeof(result->head_elems));
+        *out_result = NULL;
+        return pmh_PARSE_CANCELLED;
+    }
+    
+    *out_result = (pmh_element**)result->head_elems;
+    return pmh_PARSE_DONE;
+}
+
+// Like context_parse(), but find only the reference definitions.
+static pmh_parse_status context_parse_references(pmh_context *context,
+                                                 const char *text,
+                                                 const unsigned short *utf16,
+                                                 size_t len, int extensions,
+                                                 pmh_element **out_references)
+{
+    pmh_result *result = prepare_context_result(context);
+    if (!parse_with_context(context, text, utf16, len, extensions, true,
+                            result)) {
+        arena_reset(&result->arena);
+        memset(result->head_elems, 0, sizeof(result->head_elems));
+        *out_references = NULL;
+        return pmh_PARSE_CANCELLED;
+    }
+    
+    *out_references = (pmh_element *)result->head_elems[pmh_REFERENCE];
+    return pmh_PARSE_DONE;
+}
+
+pmh_parse_status pmh_context_parse(pmh_context *context,
+                                   const char *text, size_t len,
+                                   int extensions,
+                                   pmh_element **out_result[])
+{
+    return context_parse(context, text, NULL, len, extensions, out_result);
+}
+
+pmh_parse_status pmh_context_parse_utf16(pmh_context *context,
+                                         const unsigned short *text,
+                                         size_t len, int extensions,
+                                         pmh_element **out_result[])
+{
+    return context_parse(context, NULL, text, len, extensions, out_result);
+}
+
+pmh_parse_status pmh_context_parse_references(pmh_context *context,
+                                              const char *text, size_t len,
+                                              int extensions,
+                                              pmh_element **out_references)
+{
+    return context_parse_references(context, text, NULL, len, extensions,
+                                    out_references);
+}
+
+pmh_parse_status pmh_context_parse_references_utf16(pmh_context *context,
+                                                    const unsigned short *text,
+                                                    size_t len,
+                                                    int extensions,
+                                                    pmh_element **out_references)
+{
+    return context_parse_references(context, NULL, text, len, extensions,
+                                    out_references);
+}
+
+void pmh_context_reset(pmh_context *context)
+{
+    if (context->result != NULL) {
+        pmh_free_elements((pmh_element **)context->result->head_elems);
+        context->result = NULL;
+    }
+    
+    free(context->buffer);
+    context->buffer = NULL;
+    context->buffer_size = 0;
+    
+    free(context->strip_runs.runs);
+    memset(&context->strip_runs, 0, sizeof(context->strip_runs));
+    
+    pmh_span_index *index = &context->span_index;
+    free(index->spans);
+    free(index->offsets);
+    free(index->previous_ends);
+    memset(index, 0, sizeof(*index));
+    
+    free_greg(context);
+    
+    free(context->memo.entries);
+    context->memo.entries = NULL;
+}
+
+void pmh_context_set_memo(pmh_context *context, int rules, size_t max_bytes)
+{
+    free(context->memo.entries);
+    context->memo.entries = NULL;
+    context->memo.rules = (max_bytes >= sizeof(pmh_memo_entry)) ? rules : 0;
+    context->memo.max_bytes = max_bytes;
+}
+
+void pmh_context_set_cancel(pmh_context *context,
+                            pmh_cancel_callback callback, void *data,
+                            unsigned long step_budget)
+{
+    context->cancel_callback = callback;
+    context->cancel_data = data;
+    context->step_budget = step_budget;
+}
+
+void pmh_context_get_memo_stats(pmh_context *context,
+                                size_t *hits, size_t *misses)
+{
+    *hits = context->memo.hits;
+    *misses = context->memo.misses;
+}
+
+void pmh_context_destroy(pmh_context *context)
+{
+    if (context == NULL)
+        return;
     
-    *out_result = (pmh_element**)result;
+    pmh_context_reset(context);
+    free(context);
 }
 
 
@@ -644,6 +1690,108 @@ void pmh_sort_elements_by_pos(pmh_element *element_lists[])
         element_lists[i] = ll_mergesort(element_lists[i], &elem_compare_by_pos);
 }
 
+// Element of pmh_flatten_elements() being sorted, by (pos, type) in `key`.
+typedef struct
+{
+    unsigned long long key;
+    unsigned long end;
+} pmh_flat_record;
+
+#define FLAT_TYPE_BITS 5
+#define FLAT_RADIX_BITS 11
+#define FLAT_RADIX_SIZE (1 << FLAT_RADIX_BITS)
+
+void pmh_flatten_elements(pmh_element *element_lists[],
+                          pmh_flat_elements *flat)
+{
+    flat->len = 0;
+    if (element_lists == NULL)
+        return;
+    
+    // Gather the elements in one pass, since chasing the pointers of the
+    // lists costs more than sorting. Two halves of the scratch are used
+    // for the records and the sorted records.
+    pmh_flat_record *records = (pmh_flat_record *)flat->scratch;
+    size_t capacity = flat->capacity;
+    unsigned long long max_key = 0;
+    size_t len = 0;
+    int i;
+    pmh_element *cursor;
+    for (i = 0; i < pmh_NUM_LANG_TYPES; i++) {
+        for (cursor = element_lists[i]; cursor != NULL; cursor = cursor->next) {
+            if (cursor->end <= cursor->pos)
+                continue;
+            if (len == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                records = (pmh_flat_record *)realloc(records,
+                              sizeof(pmh_flat_record) * capacity * 2);
+            }
+            unsigned long long key = ((unsigned long long)cursor->pos
+                                      << FLAT_TYPE_BITS) | i;
+            if (key > max_key)
+                max_key = key;
+            records[len].key = key;
+            records[len].end = cursor->end;
+            len++;
+        }
+    }
+    
+    if (capacity > flat->capacity) {
+        free(flat->types);
+        free(flat->pos);
+        free(flat->end);
+        flat->types = (unsigned char *)malloc(sizeof(unsigned char) * capacity);
+        flat->pos = (unsigned long *)malloc(sizeof(unsigned long) * capacity);
+        flat->end = (unsigned long *)malloc(sizeof(unsigned long) * capacity);
+        flat->capacity = capacity;
+    }
+    flat->scratch = records;
+    
+    // LSD radix sort, as many passes as there are digits in the keys.
+    pmh_flat_record *sorted = records + capacity;
+    size_t counts[FLAT_RADIX_SIZE];
+    int shift;
+    size_t j;
+    for (shift = 0; shift == 0 || (max_key >> shift) != 0;
+         shift += FLAT_RADIX_BITS)
+    {
+        memset(counts, 0, sizeof(counts));
+        for (j = 0; j < len; j++)
+            counts[(records[j].key >> shift) & (FLAT_RADIX_SIZE - 1)]++;
+        size_t total = 0;
+        int d;
+        for (d = 0; d < FLAT_RADIX_SIZE; d++) {
+            size_t count = counts[d];
+            counts[d] = total;
+            total += count;
+        }
+        for (j = 0; j < len; j++)
+            sorted[counts[(records[j].key >> shift)
+                          & (FLAT_RADIX_SIZE - 1)]++] = records[j];
+        
+        pmh_flat_record *tmp = records;
+        records = sorted;
+        sorted = tmp;
+    }
+    
+    for (j = 0; j < len; j++) {
+        flat->types[j] = (unsigned char)(records[j].key
+                                         & ((1 << FLAT_TYPE_BITS) - 1));
+        flat->pos[j] = (unsigned long)(records[j].key >> FLAT_TYPE_BITS);
+        flat->end[j] = records[j].end;
+    }
+    flat->len = len;
+}
+
+void pmh_free_flat_elements(pmh_flat_elements *flat)
+{
+    free(flat->types);
+    free(flat->pos);
+    free(flat->end);
+    free(flat->scratch);
+    memset(flat, 0, sizeof(*flat));
+}
+
 
 
 
@@ -711,7 +1859,8 @@ static pmh_realelement *reverse(pmh_realelement *list)
 static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
                                    long pos, long end)
 {
-    pmh_realelement *result = (pmh_realelement *)malloc(sizeof(pmh_realelement));
+    pmh_realelement *result = (pmh_realelement *)
+                              arena_alloc(p_data->arena, sizeof(pmh_realelement));
     memset(result, 0, sizeof(*result));
     result->type = type;
     result->pos = pos;
@@ -726,26 +1875,104 @@ static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
     return result;
 }
 
+/* The strings of elements live as long as the parsing result, so the
+   copy shares them with the original element. */
 static pmh_realelement *copy_element(parser_data *p_data, pmh_realelement *elem)
 {
     pmh_realelement *result = mk_element(p_data, elem->type, elem->pos, elem->end);
-    result->label = strdup_or_null(elem->label);
-    result->text = strdup_or_null(elem->text);
-    result->address = strdup_or_null(elem->address);
+    result->label = elem->label;
+    result->text = elem->text;
+    result->address = elem->address;
     return result;
 }
 
-/* construct pmh_EXTRA_TEXT pmh_realelement */
+/* construct pmh_EXTRA_TEXT pmh_realelement; `string` is either a literal
+   or the text of another element */
 static pmh_realelement *mk_etext(parser_data *p_data, char *string)
 {
     pmh_realelement *result;
     assert(string != NULL);
     result = mk_element(p_data, pmh_EXTRA_TEXT, 0,0);
-    result->text = strdup_or_null(string);
+    result->text = string;
     return result;
 }
 
 
+/* Build the span index of p_data->elem_head if it is not built yet. */
+static pmh_span_index *build_span_index(parser_data *p_data)
+{
+    pmh_span_index *index = &p_data->context->span_index;
+    if (index->head != NULL && index->head == p_data->elem_head)
+        return index;
+    
+    size_t num = 0;
+    pmh_realelement *cursor = p_data->elem_head;
+    while (cursor != NULL) {
+        num++;
+        cursor = cursor->next;
+    }
+    
+    if (index->capacity < num + 1) {
+        index->capacity = (num + 1 > index->capacity * 2)
+                          ? num + 1 : index->capacity * 2;
+        index->spans = (pmh_realelement **)
+                       realloc(index->spans,
+                               sizeof(pmh_realelement *) * index->capacity);
+        index->offsets = (unsigned long *)
+                         realloc(index->offsets,
+                                 sizeof(unsigned long) * index->capacity);
+        index->previous_ends = (unsigned long *)
+                               realloc(index->previous_ends,
+                                       sizeof(unsigned long) * index->capacity);
+    }
+    
+    unsigned long c = 0;
+    unsigned long previous_end = 0;
+    size_t i = 0;
+    cursor = p_data->elem_head;
+    while (cursor != NULL)
+    {
+        index->spans[i] = cursor;
+        index->offsets[i] = c;
+        index->previous_ends[i] = previous_end;
+        
+        int thislen = (cursor->type == pmh_EXTRA_TEXT)
+                        ? strlen(cursor->text)
+                        : cursor->end - cursor->pos;
+        c += thislen;
+        if (cursor->type != pmh_EXTRA_TEXT)
+            previous_end = cursor->end;
+        
+        i++;
+        cursor = cursor->next;
+    }
+    index->spans[num] = NULL;
+    index->offsets[num] = c;
+    index->previous_ends[num] = previous_end;
+    
+    index->num_spans = num;
+    index->head = p_data->elem_head;
+    return index;
+}
+
+/* Return the index of the first span containing offset x of the parsed
+   text (i.e. the first span i with offsets[i + 1] >= x), or the
+   number of spans if there is none. */
+static size_t find_span(const pmh_span_index *index, unsigned long x)
+{
+    size_t lo = 0;
+    size_t hi = index->num_spans;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->offsets[mid + 1] >= x)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
 /*
 Given an element where the offsets {pos, end} represent
 locations in the *parsed text* (defined by the linked list of pmh_RAW and
@@ -753,6 +1980,8 @@ pmh_EXTRA_TEXT elements in p_data->current_elem), fix these offsets to represent
 corresponding offsets in the parse buffer (p_data->charbuf). Also split
 the given pmh_realelement into multiple parts if its offsets span multiple
 p_data->current_elem elements. Return the (list of) elements with real offsets.
+The spans containing the offsets are looked up in the span index, so only
+the spans in between are walked.
 */
 static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
 {
@@ -765,18 +1994,21 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
     pmh_realelement *tail = new_head;
     pmh_realelement *prev = NULL;
     
+    const pmh_span_index *index = build_span_index(p_data);
+    size_t start_idx = find_span(index, elem->pos);
+    size_t end_idx = find_span(index, elem->end);
+    size_t i = (start_idx < end_idx) ? start_idx : end_idx;
+    
     bool found_start = false;
     bool found_end = false;
     bool tail_needs_pos = false;
-    unsigned long previous_end = 0;
-    unsigned long c = 0;
+    unsigned long previous_end = index->previous_ends[i];
+    unsigned long c = index->offsets[i];
     
-    pmh_realelement *cursor = p_data->elem_head;
+    pmh_realelement *cursor = index->spans[i];
     while (cursor != NULL)
     {
-        int thislen = (cursor->type == pmh_EXTRA_TEXT)
-                        ? strlen(cursor->text)
-                        : cursor->end - cursor->pos;
+        unsigned long thislen = index->offsets[i + 1] - c;
         
         if (tail_needs_pos && cursor->type != pmh_EXTRA_TEXT) {
             tail->pos = cursor->pos;
@@ -785,7 +2017,7 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
         
         unsigned int this_pos = cursor->pos;
         
-        if (!found_start && (c <= elem->pos && elem->pos <= c+thislen)) {
+        if (!found_start && i == start_idx) {
             tail->pos = (cursor->type == pmh_EXTRA_TEXT)
                         ? previous_end
                         : cursor->pos + (elem->pos - c);
@@ -793,7 +2025,7 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
             found_start = true;
         }
         
-        if (!found_end && (c <= elem->end && elem->end <= c+thislen)) {
+        if (!found_end && i == end_idx) {
             tail->end = (cursor->type == pmh_EXTRA_TEXT)
                         ? previous_end
                         : cursor->pos + (elem->end - c);
@@ -820,7 +2052,8 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
         }
         
         c += thislen;
-        cursor = cursor->next;
+        i++;
+        cursor = index->spans[i];
     }
     
     return new_head;
@@ -880,20 +2113,101 @@ static void add(parser_data *p_data, pmh_realelement *elem)
 }
 
 
+// Map offset `pos` in charbuf to the offset in the original input, i.e.
+// add the number of bytes stripped at or before it.
+static unsigned long unstrip_offset(parser_data *p_data, unsigned long pos)
+{
+    // Find the first run after pos.
+    size_t lo = 0;
+    size_t hi = p_data->strip_runs_len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p_data->strip_runs[mid].pos <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    return (lo > 0) ? pos + p_data->strip_runs[lo - 1].total : pos;
+}
+
 // Given a range in the list of spans we use for parsing (pos, end), return
 // a copy of the corresponding section in the original input, with all of
-// the UTF-8 bytes intact:
+// the UTF-8 bytes intact. The copy is allocated in the arena:
+// Convert the spans of `spans` in the UTF-16 input to one UTF-8 string.
+// Nothing is stripped from UTF-16 input, so offsets in charbuf are offsets
+// in the input.
+static char *copy_utf16_spans(parser_data *p_data, pmh_realelement *spans)
+{
+    const unsigned short *input = p_data->context->utf16_input;
+    size_t max_len = 0;
+    pmh_realelement *cursor;
+    for (cursor = spans; cursor != NULL; cursor = cursor->next)
+    {
+        if (cursor->end > cursor->pos)
+            max_len += (cursor->end - cursor->pos) * 3;
+    }
+    
+    char *ret = (char *)arena_alloc(p_data->arena, max_len + 1);
+    char *out = ret;
+    for (cursor = spans; cursor != NULL; cursor = cursor->next)
+    {
+        unsigned long i;
+        for (i = cursor->pos; i < cursor->end; i++)
+        {
+            unsigned long c = input[i];
+            if (c >= 0xD800 && c <= 0xDBFF && i + 1 < cursor->end
+                && input[i + 1] >= 0xDC00 && input[i + 1] <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (input[i + 1] - 0xDC00);
+                i++;
+            }
+            else if (c >= 0xD800 && c <= 0xDFFF)
+            {
+                // Unpaired surrogate.
+                c = 0xFFFD;
+            }
+            
+            if (c < 0x80) {
+                *out++ = (char)c;
+            } else if (c < 0x800) {
+                *out++ = (char)(0xC0 | (c >> 6));
+                *out++ = (char)(0x80 | (c & 0x3F));
+            } else if (c < 0x10000) {
+                *out++ = (char)(0xE0 | (c >> 12));
+                *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+                *out++ = (char)(0x80 | (c & 0x3F));
+            } else {
+                *out++ = (char)(0xF0 | (c >> 18));
+                *out++ = (char)(0x80 | ((c >> 12) & 0x3F));
+                *out++ = (char)(0x80 | ((c >> 6) & 0x3F));
+                *out++ = (char)(0x80 | (c & 0x3F));
+            }
+        }
+    }
+    *out = '\0';
+    
+    return ret;
+}
+
 static char *copy_input_span(parser_data *p_data,
                              unsigned long pos, unsigned long end)
 {
     if (end <= pos)
         return NULL;
     
-    char *ret = NULL;
-    
     // Adjust (pos,end) to match actual indexes in charbuf:
     pmh_realelement *dummy = mk_element(p_data, pmh_NO_TYPE, pos, end);
     pmh_realelement *fixed_dummies = fix_offsets(p_data, dummy);
+    
+    if (p_data->context->utf16_input != NULL)
+        return copy_utf16_spans(p_data, fixed_dummies);
+    
+    // Adjust the spans to take bytes stripped from the original input into
+    // account (i.e. match the corresponding span in p_data->original_input),
+    // and get the total length:
+    size_t total_len = 0;
     pmh_realelement *cursor = fixed_dummies;
     while (cursor != NULL)
     {
@@ -903,46 +2217,27 @@ static char *copy_input_span(parser_data *p_data,
             continue;
         }
         
-        // Adjust cursor's span to take bytes stripped from the original
-        // input into account (i.e. match the corresponding span in
-        // p_data->original_input):
-        unsigned long adjusted_pos = cursor->pos;
-        unsigned long adjusted_end = cursor->end;
-        size_t i;
-        for (i = 0; i < p_data->strip_positions_len; i++)
-        {
-            unsigned long strip_position = p_data->strip_positions[i];
-            if (strip_position <= adjusted_pos)
-                adjusted_pos++;
-            if (strip_position <= adjusted_end)
-                adjusted_end++;
-            else
-                break;
-        }
-        
-        // Copy span from original input:
-        size_t adjusted_len = adjusted_end - adjusted_pos;
-        char *str = (char *)malloc(sizeof(char)*adjusted_len + 1);
-        *str = '\0';
-        strncat(str, (p_data->original_input + adjusted_pos), adjusted_len);
-        
-        if (ret == NULL)
-            ret = str;
-        else
+        cursor->pos = unstrip_offset(p_data, cursor->pos);
+        cursor->end = unstrip_offset(p_data, cursor->end);
+        total_len += cursor->end - cursor->pos;
+        cursor = cursor->next;
+    }
+    
+    // Copy spans from original input:
+    char *ret = (char *)arena_alloc(p_data->arena, total_len + 1);
+    char *out = ret;
+    cursor = fixed_dummies;
+    while (cursor != NULL)
+    {
+        if (cursor->end > cursor->pos)
         {
-            // append str to ret:
-            char *new_ret = (char *)malloc(sizeof(char)
-                                           *(strlen(str) + strlen(ret)) + 1);
-            *new_ret = '\0';
-            strcat(new_ret, ret);
-            strcat(new_ret, str);
-            free(ret);
-            free(str);
-            ret = new_ret;
+            size_t len = cursor->end - cursor->pos;
+            memcpy(out, p_data->original_input + cursor->pos, len);
+            out += len;
         }
-        
         cursor = cursor->next;
     }
+    *out = '\0';
     
     return ret;
 }
@@ -983,6 +2278,7 @@ static void yy_input_func(char *buf, int *result, int max_size,
         else
         {
             yyc = EOF;
+            p_data->num_failed_reads++;
             p_data->current_elem = p_data->current_elem->next;
             pmh_PRINTF("\e[41m \e[0m");
             if (p_data->current_elem != NULL)
@@ -992,12 +2288,42 @@ static void yy_input_func(char *buf, int *result, int max_size,
         return;
     }
     
-    *(buf) = *(p_data->charbuf + p_data->offset);
-    (*result) = (*buf != '\0');
-    p_data->offset++;
+    // Copy as much of the current pmh_RAW span as possible at once. A NUL
+    // byte ends the input as if it was read on its own.
+    const char *src = p_data->charbuf + p_data->offset;
+    size_t len = 1;
+    if (p_data->offset < p_data->current_elem->end && max_size > 1)
+    {
+        len = p_data->current_elem->end - p_data->offset;
+        if (len > (size_t)max_size)
+            len = max_size;
+    }
+    
+    const char *nul = (const char *)memchr(src, '\0', len);
+    if (nul == src)
+    {
+        *(buf) = '\0';
+        (*result) = 0;
+        p_data->num_failed_reads++;
+        len = 1;
+    }
+    else
+    {
+        if (nul != NULL)
+            len = nul - src;
+        memcpy(buf, src, len);
+        (*result) = (int)len;
+    }
+    p_data->offset += len;
     
-    pmh_PRINTF("\e[43;30m"); pmh_PUTCHAR(*buf); pmh_PRINTF("\e[0m");
-    pmh_IF(*buf == '\n') pmh_PRINTF("\e[42m \e[0m");
+    #if pmh_DEBUG_OUTPUT
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        pmh_PRINTF("\e[43;30m"); pmh_PUTCHAR(src[i]); pmh_PRINTF("\e[0m");
+        pmh_IF(src[i] == '\n') pmh_PRINTF("\e[42m \e[0m");
+    }
+    #endif
     
     if (p_data->offset >= p_data->current_elem->end)
     {
@@ -1020,8 +2346,9 @@ static void yy_input_func(char *buf, int *result, int max_size,
 #define REF_EXISTS(x) reference_exists((parser_data *)G->data, x)
 #define GET_REF(x)  get_reference((parser_data *)G->data, x)
 #define PARSING_REFERENCES ((parser_data *)G->data)->parsing_only_references
-#define FREE_LABEL(l) { free(l->label); l->label = NULL; }
-#define FREE_ADDRESS(l) { free(l->address); l->address = NULL; }
+// Strings are freed along with the arena of the result:
+#define FREE_LABEL(l) { l->label = NULL; }
+#define FREE_ADDRESS(l) { l->address = NULL; }
 
 // This gives us the text matched with < > as it appears in the original input:
 #define COPY_YYTEXT_ORIG() copy_input_span((parser_data *)G->data, thunk->begin, thunk->end)
@@ -1133,8 +2460,19 @@ YY_LOCAL(int) yyrefill(GREG *G)
   return 1;
 }
 
+// Count a match step of the parse, and fail the match if the parse has
+// been cancelled.
+#define YY_STEP(G) \
+    do { \
+        pmh_context *context = ((parser_data *)(G)->data)->context; \
+        if (++context->steps >= context->next_check \
+            && !continue_parse(context)) \
+            return 0; \
+    } while (0)
+
 YY_LOCAL(int) yymatchDot(GREG *G)
 {
+  YY_STEP(G);
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   ++G->pos;
   return 1;
@@ -1142,6 +2480,7 @@ YY_LOCAL(int) yymatchDot(GREG *G)
 
 YY_LOCAL(int) yymatchChar(GREG *G, int c)
 {
+  YY_STEP(G);
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   if ((unsigned char)G->buf[G->pos] == c)
     {
@@ -1156,6 +2495,7 @@ YY_LOCAL(int) yymatchChar(GREG *G, int c)
 YY_LOCAL(int) yymatchString(GREG *G, char *s)
 {
   int yysav= G->pos;
+  YY_STEP(G);
   while (*s)
     {
       if (G->pos >= G->limit && !yyrefill(G)) return 0;
@@ -1173,6 +2513,7 @@ YY_LOCAL(int) yymatchString(GREG *G, char *s)
 YY_LOCAL(int) yymatchClass(GREG *G, unsigned char *bits)
 {
   int c;
+  YY_STEP(G);
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   c= (unsigned char)G->buf[G->pos];
   if (bits[c >> 3] & (1 << (c & 7)))
@@ -1256,7 +2597,19 @@ YY_LOCAL(int) yyAccept(GREG *G, int tp0)
   return 1;
 }
 
-YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR) { G->val += count; }
+YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+  /* Rules nested deeper than YY_STACK_SIZE values (e.g. unclosed emphasis) */
+  /* would write past the value stack if it did not grow. */
+  int depth= G->val - G->vals;
+  while (depth + count >= G->valslen)
+    {
+      G->valslen *= 2;
+      G->vals= (YYSTYPE *)YY_REALLOC(G->vals, sizeof(YYSTYPE) * G->valslen, G->data);
+      G->val= G->vals + depth;
+    }
+  G->val += count;
+}
 YY_LOCAL(void) yyPop(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val -= count; }
 YY_LOCAL(void) yySet(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val[count]= G->ss; }
 
@@ -1582,8 +2935,8 @@ YY_ACTION(void) yy_1_Reference(GREG *G, char *yytext, int yyleng, yythunk *thunk
   yyprintf((stderr, "do yy_1_Reference\n"));
   
                 pmh_realelement *el = elem_s(pmh_REFERENCE);
-                el->label = strdup_or_null(l->label);
-                el->address = strdup_or_null(r->address);
+                el->label = l->label;
+                el->address = r->address;
                 ADD(el);
                 FREE_LABEL(l);
                 FREE_ADDRESS(r);
@@ -1663,7 +3016,7 @@ YY_ACTION(void) yy_1_ExplicitLink(GREG *G, char *yytext, int yyleng, yythunk *th
   
                     yy = elem_s(pmh_LINK);
                     if (l->address != NULL)
-                        yy->address = strdup_or_null(l->address);
+                        yy->address = l->address;
                     FREE_LABEL(s);
                     FREE_ADDRESS(l);
                 ;
@@ -1678,8 +3031,8 @@ YY_ACTION(void) yy_1_ReferenceLinkSingle(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(s->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(s->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = s->label;
+                                yy->address = reference->address;
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -1695,8 +3048,8 @@ YY_ACTION(void) yy_1_ReferenceLinkDouble(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(l->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(l->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = l->label;
+                                yy->address = reference->address;
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -2644,7 +3997,7 @@ YY_RULE(int) yy_ExplicitLink(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "ExplicitLink", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_StrongUl(GREG *G)
+YY_RULE(int) yy_StrongUl_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "StrongUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l163;  if (!yy_LocMarker(G)) { goto l163; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "__")) goto l163;
   {  int yypos164= G->pos, yythunkpos164= G->thunkpos;  if (!yy_Whitespace(G)) { goto l164; }  goto l163;
@@ -2666,7 +4019,7 @@ YY_RULE(int) yy_StrongUl(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "StrongUl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_StrongStar(GREG *G)
+YY_RULE(int) yy_StrongStar_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "StrongStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l169;  if (!yy_LocMarker(G)) { goto l169; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "**")) goto l169;
   {  int yypos170= G->pos, yythunkpos170= G->thunkpos;  if (!yy_Whitespace(G)) { goto l170; }  goto l169;
@@ -2701,7 +4054,7 @@ YY_RULE(int) yy_Whitespace(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Whitespace", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_EmphUl(GREG *G)
+YY_RULE(int) yy_EmphUl_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "EmphUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l178;  if (!yy_LocMarker(G)) { goto l178; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '_')) goto l178;
   {  int yypos179= G->pos, yythunkpos179= G->thunkpos;  if (!yy_Whitespace(G)) { goto l179; }  goto l178;
@@ -2731,7 +4084,7 @@ YY_RULE(int) yy_EmphUl(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "EmphUl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_EmphStar(GREG *G)
+YY_RULE(int) yy_EmphStar_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "EmphStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l188;  if (!yy_LocMarker(G)) { goto l188; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '*')) goto l188;
   {  int yypos189= G->pos, yythunkpos189= G->thunkpos;  if (!yy_Whitespace(G)) { goto l189; }  goto l188;
@@ -3553,7 +4906,7 @@ YY_RULE(int) yy_Image(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Image", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Strike(GREG *G)
+YY_RULE(int) yy_Strike_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "Strike"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_STRIKE) )) goto l570;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l570;  if (!yy_LocMarker(G)) { goto l570; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "~~")) goto l570;
   {  int yypos571= G->pos, yythunkpos571= G->thunkpos;  if (!yy_Whitespace(G)) { goto l571; }  goto l570;
@@ -3806,7 +5159,7 @@ YY_RULE(int) yy_HtmlComment(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlComment", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockInTags(GREG *G)
+YY_RULE(int) yy_HtmlBlockInTags_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockInTags"));
   {  int yypos687= G->pos, yythunkpos687= G->thunkpos;  if (!yy_HtmlBlockAddress(G)) { goto l688; }  goto l687;
@@ -3851,7 +5204,7 @@ YY_RULE(int) yy_HtmlBlockInTags(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockInTags", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockHead(GREG *G)
+YY_RULE(int) yy_HtmlBlockHead_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockHead"));  if (!yy_HtmlBlockOpenHead(G)) { goto l721; }
   l722:;	
@@ -3897,7 +5250,7 @@ YY_RULE(int) yy_HtmlBlockOpenHead(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenHead", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockScript(GREG *G)
+YY_RULE(int) yy_HtmlBlockScript_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockScript"));  if (!yy_HtmlBlockOpenScript(G)) { goto l733; }
   l734:;	
@@ -3943,7 +5296,7 @@ YY_RULE(int) yy_HtmlBlockOpenScript(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenScript", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTr(GREG *G)
+YY_RULE(int) yy_HtmlBlockTr_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTr"));  if (!yy_HtmlBlockOpenTr(G)) { goto l745; }
   l746:;	
@@ -3993,7 +5346,7 @@ YY_RULE(int) yy_HtmlBlockOpenTr(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTr", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockThead(GREG *G)
+YY_RULE(int) yy_HtmlBlockThead_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockThead"));  if (!yy_HtmlBlockOpenThead(G)) { goto l759; }
   l760:;	
@@ -4043,7 +5396,7 @@ YY_RULE(int) yy_HtmlBlockOpenThead(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenThead", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTh(GREG *G)
+YY_RULE(int) yy_HtmlBlockTh_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTh"));  if (!yy_HtmlBlockOpenTh(G)) { goto l773; }
   l774:;	
@@ -4093,7 +5446,7 @@ YY_RULE(int) yy_HtmlBlockOpenTh(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTh", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTfoot(GREG *G)
+YY_RULE(int) yy_HtmlBlockTfoot_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTfoot"));  if (!yy_HtmlBlockOpenTfoot(G)) { goto l787; }
   l788:;	
@@ -4143,7 +5496,7 @@ YY_RULE(int) yy_HtmlBlockOpenTfoot(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTfoot", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTd(GREG *G)
+YY_RULE(int) yy_HtmlBlockTd_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTd"));  if (!yy_HtmlBlockOpenTd(G)) { goto l801; }
   l802:;	
@@ -4193,7 +5546,7 @@ YY_RULE(int) yy_HtmlBlockOpenTd(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTd", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTbody(GREG *G)
+YY_RULE(int) yy_HtmlBlockTbody_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTbody"));  if (!yy_HtmlBlockOpenTbody(G)) { goto l815; }
   l816:;	
@@ -4243,7 +5596,7 @@ YY_RULE(int) yy_HtmlBlockOpenTbody(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTbody", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockLi(GREG *G)
+YY_RULE(int) yy_HtmlBlockLi_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockLi"));  if (!yy_HtmlBlockOpenLi(G)) { goto l829; }
   l830:;	
@@ -4293,7 +5646,7 @@ YY_RULE(int) yy_HtmlBlockOpenLi(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenLi", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockFrameset(GREG *G)
+YY_RULE(int) yy_HtmlBlockFrameset_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockFrameset"));  if (!yy_HtmlBlockOpenFrameset(G)) { goto l843; }
   l844:;	
@@ -4343,7 +5696,7 @@ YY_RULE(int) yy_HtmlBlockOpenFrameset(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenFrameset", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockDt(GREG *G)
+YY_RULE(int) yy_HtmlBlockDt_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockDt"));  if (!yy_HtmlBlockOpenDt(G)) { goto l857; }
   l858:;	
@@ -4393,7 +5746,7 @@ YY_RULE(int) yy_HtmlBlockOpenDt(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenDt", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockDd(GREG *G)
+YY_RULE(int) yy_HtmlBlockDd_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockDd"));  if (!yy_HtmlBlockOpenDd(G)) { goto l871; }
   l872:;	
@@ -4443,7 +5796,7 @@ YY_RULE(int) yy_HtmlBlockOpenDd(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenDd", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockUl(GREG *G)
+YY_RULE(int) yy_HtmlBlockUl_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockUl"));  if (!yy_HtmlBlockOpenUl(G)) { goto l885; }
   l886:;	
@@ -4493,7 +5846,7 @@ YY_RULE(int) yy_HtmlBlockOpenUl(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenUl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockTable(GREG *G)
+YY_RULE(int) yy_HtmlBlockTable_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockTable"));  if (!yy_HtmlBlockOpenTable(G)) { goto l899; }
   l900:;	
@@ -4543,7 +5896,7 @@ YY_RULE(int) yy_HtmlBlockOpenTable(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenTable", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockPre(GREG *G)
+YY_RULE(int) yy_HtmlBlockPre_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockPre"));  if (!yy_HtmlBlockOpenPre(G)) { goto l913; }
   l914:;	
@@ -4593,7 +5946,7 @@ YY_RULE(int) yy_HtmlBlockOpenPre(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenPre", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockP(GREG *G)
+YY_RULE(int) yy_HtmlBlockP_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockP"));  if (!yy_HtmlBlockOpenP(G)) { goto l927; }
   l928:;	
@@ -4643,7 +5996,7 @@ YY_RULE(int) yy_HtmlBlockOpenP(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenP", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockOl(GREG *G)
+YY_RULE(int) yy_HtmlBlockOl_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockOl"));  if (!yy_HtmlBlockOpenOl(G)) { goto l941; }
   l942:;	
@@ -4693,7 +6046,7 @@ YY_RULE(int) yy_HtmlBlockOpenOl(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenOl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockNoscript(GREG *G)
+YY_RULE(int) yy_HtmlBlockNoscript_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockNoscript"));  if (!yy_HtmlBlockOpenNoscript(G)) { goto l955; }
   l956:;	
@@ -4743,7 +6096,7 @@ YY_RULE(int) yy_HtmlBlockOpenNoscript(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenNoscript", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockNoframes(GREG *G)
+YY_RULE(int) yy_HtmlBlockNoframes_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockNoframes"));  if (!yy_HtmlBlockOpenNoframes(G)) { goto l969; }
   l970:;	
@@ -4793,7 +6146,7 @@ YY_RULE(int) yy_HtmlBlockOpenNoframes(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenNoframes", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockMenu(GREG *G)
+YY_RULE(int) yy_HtmlBlockMenu_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockMenu"));  if (!yy_HtmlBlockOpenMenu(G)) { goto l983; }
   l984:;	
@@ -4843,7 +6196,7 @@ YY_RULE(int) yy_HtmlBlockOpenMenu(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenMenu", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH6(GREG *G)
+YY_RULE(int) yy_HtmlBlockH6_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH6"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l997;  if (!yy_LocMarker(G)) { goto l997; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH6(G)) { goto l997; }
   l998:;	
@@ -4893,7 +6246,7 @@ YY_RULE(int) yy_HtmlBlockOpenH6(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH6", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH5(GREG *G)
+YY_RULE(int) yy_HtmlBlockH5_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH5"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1011;  if (!yy_LocMarker(G)) { goto l1011; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH5(G)) { goto l1011; }
   l1012:;	
@@ -4943,7 +6296,7 @@ YY_RULE(int) yy_HtmlBlockOpenH5(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH5", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH4(GREG *G)
+YY_RULE(int) yy_HtmlBlockH4_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH4"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1025;  if (!yy_LocMarker(G)) { goto l1025; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH4(G)) { goto l1025; }
   l1026:;	
@@ -4993,7 +6346,7 @@ YY_RULE(int) yy_HtmlBlockOpenH4(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH4", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH3(GREG *G)
+YY_RULE(int) yy_HtmlBlockH3_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH3"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1039;  if (!yy_LocMarker(G)) { goto l1039; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH3(G)) { goto l1039; }
   l1040:;	
@@ -5043,7 +6396,7 @@ YY_RULE(int) yy_HtmlBlockOpenH3(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH3", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH2(GREG *G)
+YY_RULE(int) yy_HtmlBlockH2_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH2"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1053;  if (!yy_LocMarker(G)) { goto l1053; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH2(G)) { goto l1053; }
   l1054:;	
@@ -5093,7 +6446,7 @@ YY_RULE(int) yy_HtmlBlockOpenH2(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH2", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockH1(GREG *G)
+YY_RULE(int) yy_HtmlBlockH1_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "HtmlBlockH1"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1067;  if (!yy_LocMarker(G)) { goto l1067; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH1(G)) { goto l1067; }
   l1068:;	
@@ -5143,7 +6496,7 @@ YY_RULE(int) yy_HtmlBlockOpenH1(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenH1", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockForm(GREG *G)
+YY_RULE(int) yy_HtmlBlockForm_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockForm"));  if (!yy_HtmlBlockOpenForm(G)) { goto l1081; }
   l1082:;	
@@ -5193,7 +6546,7 @@ YY_RULE(int) yy_HtmlBlockOpenForm(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenForm", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockFieldset(GREG *G)
+YY_RULE(int) yy_HtmlBlockFieldset_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockFieldset"));  if (!yy_HtmlBlockOpenFieldset(G)) { goto l1095; }
   l1096:;	
@@ -5243,7 +6596,7 @@ YY_RULE(int) yy_HtmlBlockOpenFieldset(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenFieldset", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockDl(GREG *G)
+YY_RULE(int) yy_HtmlBlockDl_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockDl"));  if (!yy_HtmlBlockOpenDl(G)) { goto l1109; }
   l1110:;	
@@ -5293,7 +6646,7 @@ YY_RULE(int) yy_HtmlBlockOpenDl(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenDl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockDiv(GREG *G)
+YY_RULE(int) yy_HtmlBlockDiv_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockDiv"));  if (!yy_HtmlBlockOpenDiv(G)) { goto l1123; }
   l1124:;	
@@ -5343,7 +6696,7 @@ YY_RULE(int) yy_HtmlBlockOpenDiv(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenDiv", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockDir(GREG *G)
+YY_RULE(int) yy_HtmlBlockDir_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockDir"));  if (!yy_HtmlBlockOpenDir(G)) { goto l1137; }
   l1138:;	
@@ -5393,7 +6746,7 @@ YY_RULE(int) yy_HtmlBlockOpenDir(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenDir", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockCenter(GREG *G)
+YY_RULE(int) yy_HtmlBlockCenter_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockCenter"));  if (!yy_HtmlBlockOpenCenter(G)) { goto l1151; }
   l1152:;	
@@ -5443,7 +6796,7 @@ YY_RULE(int) yy_HtmlBlockOpenCenter(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenCenter", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockBlockquote(GREG *G)
+YY_RULE(int) yy_HtmlBlockBlockquote_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockBlockquote"));  if (!yy_HtmlBlockOpenBlockquote(G)) { goto l1165; }
   l1166:;	
@@ -5493,7 +6846,7 @@ YY_RULE(int) yy_HtmlBlockOpenBlockquote(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "HtmlBlockOpenBlockquote", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_HtmlBlockAddress(GREG *G)
+YY_RULE(int) yy_HtmlBlockAddress_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "HtmlBlockAddress"));  if (!yy_HtmlBlockOpenAddress(G)) { goto l1179; }
   l1180:;	
@@ -6443,9 +7796,113 @@ YY_RULE(int) yy_Doc(GREG *G)
   return 1;
 }
 
+typedef int (*yyrule)(GREG *G);
+
+/* Memoized rules. Each yy_X() below calls yy_X_unmemoized(), which is the
+   rule generated from the grammar, through memo_rule(). */
+
+// Call `rule` at the current position, or replay its memoized result.
+// Only results which could be replayed exactly are stored: the rule must
+// not have run out of input, and it must not have added any action if it
+// succeeded.
+static int memo_rule(GREG *G, int rule_id, int group, yyrule rule)
+{
+    parser_data *p_data = (parser_data *)G->data;
+    pmh_memo *memo = &p_data->context->memo;
+    if (memo->entries == NULL || !(memo->rules & group))
+        return rule(G);
+    
+    size_t slot = ((size_t)G->pos * 31 + rule_id) & memo->mask;
+    pmh_memo_entry *entry = &memo->entries[slot];
+    if (entry->generation == memo->generation
+        && entry->pos == G->pos
+        && entry->rule == rule_id)
+    {
+        memo->hits++;
+        if (entry->sets_text) {
+            G->begin = entry->text_begin;
+            G->end = entry->text_end;
+        }
+        if (entry->end < 0)
+            return 0;
+        G->pos = entry->end;
+        return 1;
+    }
+    
+    memo->misses++;
+    int pos = G->pos;
+    int thunkpos = G->thunkpos;
+    int begin = G->begin;
+    int end = G->end;
+    unsigned long num_failed_reads = p_data->num_failed_reads;
+    
+    int ok = rule(G);
+    
+    if (p_data->num_failed_reads == num_failed_reads
+        && !p_data->context->cancelled
+        && (!ok || G->thunkpos == thunkpos))
+    {
+        entry->generation = memo->generation;
+        entry->rule = (short)rule_id;
+        entry->pos = pos;
+        entry->end = ok ? G->pos : -1;
+        entry->sets_text = (G->begin != begin || G->end != end);
+        entry->text_begin = G->begin;
+        entry->text_end = G->end;
+    }
+    
+    return ok;
+}
+
+#define MEMOIZED_RULE(name, id, group) \
+    YY_RULE(int) yy_##name(GREG *G) \
+    { \
+        return memo_rule(G, id, group, yy_##name##_unmemoized); \
+    }
+
+MEMOIZED_RULE(HtmlBlockInTags, 154, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockAddress, 54, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockBlockquote, 57, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockCenter, 60, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockDir, 63, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockDiv, 66, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockDl, 69, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockFieldset, 72, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockForm, 75, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH1, 78, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH2, 81, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH3, 84, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH4, 87, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH5, 90, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockH6, 93, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockMenu, 96, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockNoframes, 99, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockNoscript, 102, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockOl, 105, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockP, 108, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockPre, 111, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTable, 114, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockUl, 117, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockDd, 120, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockDt, 123, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockFrameset, 126, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockLi, 129, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTbody, 132, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTd, 135, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTfoot, 138, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTh, 141, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockThead, 144, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockTr, 147, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockScript, 150, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(HtmlBlockHead, 153, pmh_MEMO_HTML_BLOCKS)
+MEMOIZED_RULE(EmphStar, 188, pmh_MEMO_EMPHASIS)
+MEMOIZED_RULE(EmphUl, 189, pmh_MEMO_EMPHASIS)
+MEMOIZED_RULE(StrongStar, 191, pmh_MEMO_EMPHASIS)
+MEMOIZED_RULE(StrongUl, 192, pmh_MEMO_EMPHASIS)
+MEMOIZED_RULE(Strike, 166, pmh_MEMO_EMPHASIS)
+
 #ifndef YY_PART
 
-typedef int (*yyrule)(GREG *G);
 
 YY_PARSE(int) YY_NAME(parse_from)(GREG *G, yyrule yystart)
 {
@@ -6522,18 +7979,59 @@ YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
  */
 
 
+// Prepare the memo table for a new (sub)parse.
+static void start_memo(pmh_memo *memo)
+{
+    if (memo->rules == 0)
+        return;
+    
+    if (memo->entries == NULL)
+    {
+        size_t num = 1;
+        while (num * 2 * sizeof(pmh_memo_entry) <= memo->max_bytes)
+            num *= 2;
+        memo->entries = (pmh_memo_entry *)calloc(num, sizeof(pmh_memo_entry));
+        memo->mask = num - 1;
+        memo->generation = 0;
+    }
+    
+    // Entries of previous parses are invalidated by the generation.
+    memo->generation++;
+    if (memo->generation == 0) {
+        memset(memo->entries, 0, sizeof(pmh_memo_entry) * (memo->mask + 1));
+        memo->generation = 1;
+    }
+}
+
 static void _parse(parser_data *p_data, yyrule start_rule)
 {
-    GREG *g = YY_NAME(parse_new)(p_data);
+    // Reuse the buffers and stacks of the previous parse.
+    GREG *g = p_data->context->greg;
+    if (g == NULL) {
+        g = YY_NAME(parse_new)(p_data);
+        p_data->context->greg = g;
+    }
+    g->data = p_data;
+    g->offset = g->limit = 0;
+    
+    start_memo(&p_data->context->memo);
+    
     if (start_rule == NULL)
         YY_NAME(parse)(g);
     else
         YY_NAME(parse_from)(g, start_rule);
-    YY_NAME(parse_free)(g);
     
     pmh_PRINTF("\n\n");
 }
 
+static void free_greg(pmh_context *context)
+{
+    if (context->greg != NULL) {
+        YY_NAME(parse_free)(context->greg);
+        context->greg = NULL;
+    }
+}
+
 static void parse_markdown(parser_data *p_data)
 {
     pmh_PRINTF("\nPARSING DOCUMENT: ");
@@ -41,6 +41,239 @@
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[]);
 
+/**
+* \brief Parse Markdown text of given length, return elements
+* 
+* Like pmh_markdown_to_elements(), but takes the length of the text instead
+* of relying on a null terminator, and lets the caller keep the buffer used
+* to preprocess the text so that it could be reused across parses.
+* 
+* \param[in]     text         The Markdown text to parse for highlighting.
+*                             Need not be null-terminated.
+* \param[in]     len          Length of text in bytes.
+* \param[in]     extensions   The extensions to use in parsing (a bitfield
+*                             of pmh_extensions values).
+* \param[in,out] buffer       Buffer used to preprocess the text. Could point
+*                             to NULL at first. It will be reallocated if it
+*                             is smaller than len + 3 bytes. The caller must
+*                             free() it when it's not needed anymore.
+* \param[in,out] buffer_size  Size of *buffer in bytes.
+* \param[out]    out_result   Same as pmh_markdown_to_elements().
+* 
+* \sa pmh_markdown_to_elements
+*/
+void pmh_markdown_to_elements_len(const char *text, size_t len, int extensions,
+                                  char **buffer, size_t *buffer_size,
+                                  pmh_element **out_result[]);
+
+/**
+* \brief Parser context
+* 
+* Keeps the buffers of the parser, and the memory of the elements, warm
+* across parses. A context must not be used by several threads at once.
+*/
+typedef struct pmh_Context pmh_context;
+
+/**
+* \brief Create a parser context
+* 
+* \return A new context, which must be passed to pmh_context_destroy()
+*         when it's not needed anymore.
+*/
+pmh_context *pmh_context_create();
+
+/**
+* \brief Status of a parse with a context
+* 
+* \sa pmh_context_parse
+*/
+typedef enum
+{
+    pmh_PARSE_DONE = 0,     /**< The parse finished */
+    pmh_PARSE_CANCELLED     /**< The parse was cancelled or ran out of steps */
+} pmh_parse_status;
+
+/**
+* \brief Parse Markdown text with a context, return elements
+* 
+* Like pmh_markdown_to_elements_len(), but the buffers and the result are
+* owned by the context. The result is valid until the next call of
+* pmh_context_parse(), pmh_context_reset() or pmh_context_destroy() on the
+* same context, and must not be passed to pmh_free_elements().
+* 
+* A parse could be cancelled with pmh_context_set_cancel(), in which case
+* its partial elements are dropped and out_result is set to NULL.
+* 
+* \param[in]  context     The context to parse with.
+* \param[in]  text        The Markdown text to parse for highlighting.
+*                         Need not be null-terminated.
+* \param[in]  len         Length of text in bytes.
+* \param[in]  extensions  The extensions to use in parsing (a bitfield
+*                         of pmh_extensions values).
+* \param[out] out_result  Same as pmh_markdown_to_elements(), or NULL if
+*                         the parse is cancelled.
+* 
+* \return pmh_PARSE_DONE, or pmh_PARSE_CANCELLED if the parse is cancelled.
+* 
+* \sa pmh_markdown_to_elements_len
+*/
+pmh_parse_status pmh_context_parse(pmh_context *context,
+                                   const char *text, size_t len,
+                                   int extensions,
+                                   pmh_element **out_result[]);
+
+/**
+* \brief Parse UTF-16 Markdown text with a context, return elements
+* 
+* Like pmh_context_parse(), but the text is read as UTF-16 code units, and
+* the offsets of the elements are in code units instead of code points.
+* That is, a character outside the Basic Multilingual Plane (e.g. an emoji)
+* takes two, like in QString and QTextDocument. Labels and addresses of the
+* elements are still UTF-8. A byte order mark is not skipped.
+* 
+* \param[in]  context     The context to parse with.
+* \param[in]  text        The Markdown text to parse for highlighting.
+*                         Need not be null-terminated.
+* \param[in]  len         Length of text in code units.
+* \param[in]  extensions  The extensions to use in parsing (a bitfield
+*                         of pmh_extensions values).
+* \param[out] out_result  Same as pmh_context_parse().
+* 
+* \return pmh_PARSE_DONE, or pmh_PARSE_CANCELLED if the parse is cancelled.
+* 
+* \sa pmh_context_parse
+*/
+pmh_parse_status pmh_context_parse_utf16(pmh_context *context,
+                                         const unsigned short *text,
+                                         size_t len, int extensions,
+                                         pmh_element **out_result[]);
+
+/**
+* \brief Find the reference definitions of Markdown text with a context
+* 
+* Runs only the first pass of pmh_context_parse(), which collects the
+* reference definitions that reference links are resolved against. This is
+* much cheaper than a full parse. The result is owned by the context like
+* the one of pmh_context_parse().
+* 
+* \param[in]  context         The context to parse with.
+* \param[in]  text            The Markdown text. Need not be
+*                             null-terminated.
+* \param[in]  len             Length of text in bytes.
+* \param[in]  extensions      The extensions to use in parsing (a bitfield
+*                             of pmh_extensions values).
+* \param[out] out_references  A linked list of pmh_REFERENCE elements, in
+*                             reverse order of position, or NULL if there
+*                             is none or the parse is cancelled.
+* 
+* \return pmh_PARSE_DONE, or pmh_PARSE_CANCELLED if the parse is cancelled.
+*/
+pmh_parse_status pmh_context_parse_references(pmh_context *context,
+                                              const char *text, size_t len,
+                                              int extensions,
+                                              pmh_element **out_references);
+
+/**
+* \brief Find the reference definitions of UTF-16 Markdown text
+* 
+* Like pmh_context_parse_references(), with text and offsets in UTF-16 code
+* units as in pmh_context_parse_utf16().
+* 
+* \sa pmh_context_parse_references
+* \sa pmh_context_parse_utf16
+*/
+pmh_parse_status pmh_context_parse_references_utf16(pmh_context *context,
+                                                    const unsigned short *text,
+                                                    size_t len,
+                                                    int extensions,
+                                                    pmh_element **out_references);
+
+/**
+* \brief Callback to check whether a parse should be cancelled
+* 
+* \param[in]  data  The data given to pmh_context_set_cancel().
+* 
+* \return Non-zero to cancel the parse.
+*/
+typedef int (*pmh_cancel_callback)(void *data);
+
+/**
+* \brief Make the parses of a context cancellable
+* 
+* The callback is called periodically from within a parse, on the thread
+* running the parse, so it must be cheap and thread-safe if it looks at
+* data of other threads. A parse is also cancelled once it has taken
+* step_budget match steps, which is roughly proportional to parse time.
+* 
+* \param[in]  context      The context to configure.
+* \param[in]  callback     The callback, or NULL to disable it.
+* \param[in]  data         Data passed to the callback.
+* \param[in]  step_budget  Max number of match steps of a parse, or 0 for
+*                          no limit.
+*/
+void pmh_context_set_cancel(pmh_context *context,
+                            pmh_cancel_callback callback, void *data,
+                            unsigned long step_budget);
+
+/**
+* \brief Release the memory kept by a parser context
+* 
+* Frees the result of the last parse and all the buffers of the context,
+* which could still be used afterwards.
+* 
+* \param[in]  context  The context to reset.
+*/
+void pmh_context_reset(pmh_context *context);
+
+/**
+* \brief Destroy a parser context
+* 
+* \param[in]  context  The context to destroy, along with the result of its
+*                      last parse. Could be NULL.
+*/
+void pmh_context_destroy(pmh_context *context);
+
+/**
+* \brief Groups of rules which could be memoized
+* 
+* These rules backtrack a lot on some inputs (e.g. nested or unclosed HTML
+* blocks, and unclosed emphasis), which could make parse time superlinear.
+* 
+* \sa pmh_context_set_memo
+*/
+typedef enum
+{
+    pmh_MEMO_NONE = 0,
+    pmh_MEMO_HTML_BLOCKS = 1 << 0,  /**< HTML block rules */
+    pmh_MEMO_EMPHASIS = 1 << 1      /**< Emphasis, strong and strike rules */
+} pmh_memo_rules;
+
+/**
+* \brief Memoize the results of expensive rules in a context
+* 
+* Results of the given rules are remembered by position within a parse, so
+* that backtracking does not parse the same text with the same rule again.
+* The memo table is allocated on the next parse and takes at most
+* max_bytes. When it is full, new results replace old ones. Memoization is
+* disabled by default.
+* 
+* \param[in]  context    The context to configure.
+* \param[in]  rules      The rules to memoize (a bitfield of pmh_memo_rules
+*                        values), or pmh_MEMO_NONE to disable it.
+* \param[in]  max_bytes  Memory cap of the memo table in bytes.
+*/
+void pmh_context_set_memo(pmh_context *context, int rules, size_t max_bytes);
+
+/**
+* \brief Get memo statistics of the last parse of a context
+* 
+* \param[in]  context  The context.
+* \param[out] hits     Number of rule calls answered by the memo.
+* \param[out] misses   Number of memoized rule calls which ran the rule.
+*/
+void pmh_context_get_memo_stats(pmh_context *context,
+                                size_t *hits, size_t *misses);
+
 /**
 * \brief Sort elements in list by start offset.
 * 
@@ -55,6 +288,49 @@ void pmh_markdown_to_elements(char *text, int extensions,
 */
 void pmh_sort_elements_by_pos(pmh_element *element_lists[]);
 
+/**
+* \brief Flat array of elements
+* 
+* Elements of all types in three parallel arrays, sorted by start offset
+* (and then by type), without zero-length elements.
+* 
+* \sa pmh_flatten_elements
+*/
+typedef struct
+{
+    unsigned char *types;   /**< Type of each element (pmh_element_type) */
+    unsigned long *pos;     /**< Start offset of each element */
+    unsigned long *end;     /**< End offset of each element */
+    size_t len;             /**< Number of elements */
+    
+    size_t capacity;        /**< Internal to parser. Please ignore. */
+    void *scratch;          /**< Internal to parser. Please ignore. */
+} pmh_flat_elements;
+
+/**
+* \brief Flatten elements into arrays sorted by start offset
+* 
+* Unlike pmh_sort_elements_by_pos(), it takes time linear in the number of
+* elements and leaves element_lists unchanged. The arrays of flat are reused
+* if they are large enough.
+* 
+* \param[in]     element_lists  Array of linked lists of elements (output
+*                               from pmh_markdown_to_elements()), or NULL
+*                               for no elements.
+* \param[in,out] flat           The flat array to fill, zero-initialized
+*                               before first use. Must be freed with
+*                               pmh_free_flat_elements().
+*/
+void pmh_flatten_elements(pmh_element *element_lists[],
+                          pmh_flat_elements *flat);
+
+/**
+* \brief Free the arrays of a flat array of elements
+* 
+* \param[in]  flat  The flat array, which is left empty.
+*/
+void pmh_free_flat_elements(pmh_flat_elements *flat);
+
 /**
 * \brief Free pmh_element array
 * 
@@ -67,6 +343,20 @@ void pmh_sort_elements_by_pos(pmh_element *element_lists[]);
 */
 void pmh_free_elements(pmh_element **elems);
 
+/**
+* \brief Get allocation statistics of a parsing result
+* 
+* The elements and strings of a parsing result are allocated from memory
+* blocks owned by the result, which are freed at once by pmh_free_elements().
+* 
+* \param[in]  elems       The pmh_element array resulting from calling
+*                         pmh_markdown_to_elements() or pmh_context_parse().
+* \param[out] num_allocs  Number of allocations served by the blocks.
+* \param[out] num_blocks  Number of blocks allocated from the system.
+*/
+void pmh_get_allocation_stats(pmh_element **elems,
+                              size_t *num_allocs, size_t *num_blocks);
+
 /**
 * \brief Get element type name
 * 
@@ -0,0 +1,895 @@
+#include "hgcodeblocktokenizer.h"
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include "hgmarkdownhighlighter.h"
+
+// Styles of tokens.
+enum TokenStyle
+{
+    KeywordStyle = 0,
+    BuiltInStyle,
+    LiteralStyle,
+    TypeStyle,
+    StringStyle,
+    NumberStyle,
+    CommentStyle,
+    MetaStyle,
+    MetaKeywordStyle,
+    MetaStringStyle,
+    TitleStyle,
+    VariableStyle,
+    AttrStyle,
+    BulletStyle,
+    NumOfTokenStyles
+};
+
+// Class names of highlight.js of each TokenStyle.
+static const char *c_styleNames[NumOfTokenStyles] = {
+    "hljs-keyword", "hljs-built_in", "hljs-literal", "hljs-type", "hljs-string",
+    "hljs-number", "hljs-comment", "hljs-meta", "hljs-meta-keyword",
+    "hljs-meta-string", "hljs-title", "hljs-variable", "hljs-attr", "hljs-bullet"
+};
+
+enum LexerFlag
+{
+    // Words are case insensitive.
+    CaseInsensitive = 0x1,
+
+    // /* */ comments.
+    BlockComments = 0x2,
+
+    // Preprocessor directives of C.
+    Directives = 0x4,
+
+    // Words ending with "_t", like size_t, are keywords.
+    TypeNames = 0x8,
+
+    // Strings in triple quotes of Python.
+    TripleQuotes = 0x10,
+
+    // Decorators of Python.
+    Decorators = 0x20,
+
+    // Variables and shebang of shell.
+    ShellSyntax = 0x40,
+
+    // Quotes within strings are escaped by doubling them, like 'it''s'.
+    DoubledQuotes = 0x80,
+
+    // Strings followed by ':' are keys of objects.
+    KeyStrings = 0x100,
+
+    // Keys, bullets, document markers, block scalars, tags and anchors of
+    // YAML.
+    YamlSyntax = 0x200,
+
+    // Numbers may start with '-'.
+    SignedNumbers = 0x400,
+
+    // Numbers are not highlighted.
+    NoNumbers = 0x800
+};
+
+// Definition of the lexer of a language. Lists are separated by spaces.
+struct LexerDef
+{
+    // Names of the language in fences.
+    const char *m_names;
+
+    // Combination of LexerFlag.
+    int m_flags;
+
+    // Start of line comments, or NULL.
+    const char *m_lineComment;
+
+    // Characters starting strings.
+    const char *m_quotes;
+
+    // Quotes of strings spanning lines.
+    const char *m_multiLineQuotes;
+
+    // Quotes of strings without backslash escapes.
+    const char *m_rawQuotes;
+
+    // Prefixes of strings, like r of r"\d".
+    const char *m_stringPrefixes;
+
+    // Keywords followed by a name highlighted as title.
+    const char *m_titleKeywords;
+
+    const char *m_keywords;
+    const char *m_builtIns;
+    const char *m_literals;
+};
+
+static const LexerDef c_lexerDefs[] = {
+    {
+        "cpp c cc h c++ h++ hpp",
+        BlockComments | Directives | TypeNames | SignedNumbers,
+        "//", "\"'", "", "", "u8 u U L R u8R uR UR LR", "",
+        "int float while private char catch import module export virtual operator "
+        "sizeof dynamic_cast typedef const_cast const struct for static_cast union "
+        "namespace unsigned long volatile static protected bool template mutable if "
+        "public friend do goto auto void enum else break extern using class asm case "
+        "typeid short reinterpret_cast default double register explicit signed "
+        "typename try this switch continue inline delete alignof constexpr decltype "
+        "noexcept static_assert thread_local restrict _Bool complex _Complex "
+        "_Imaginary atomic_bool atomic_char atomic_schar atomic_uchar atomic_short "
+        "atomic_ushort atomic_int atomic_uint atomic_long atomic_ulong atomic_llong "
+        "atomic_ullong new throw return",
+        "std string cin cout cerr clog stdin stdout stderr stringstream "
+        "istringstream ostringstream auto_ptr deque list queue stack vector map set "
+        "bitset multiset multimap unordered_set unordered_map unordered_multiset "
+        "unordered_multimap array shared_ptr abort abs acos asin atan2 atan calloc "
+        "ceil cosh cos exit exp fabs floor fmod fprintf fputs free frexp fscanf "
+        "isalnum isalpha iscntrl isdigit isgraph islower isprint ispunct isspace "
+        "isupper isxdigit tolower toupper labs ldexp log10 log malloc realloc memchr "
+        "memcmp memcpy memset modf pow printf putchar puts scanf sinh sin snprintf "
+        "sprintf sqrt sscanf strcat strchr strcmp strcpy strcspn strlen strncat "
+        "strncmp strncpy strpbrk strrchr strspn strstr tanh tan vfprintf vprintf "
+        "vsprintf endl initializer_list unique_ptr",
+        "true false nullptr NULL"
+    },
+    {
+        "python py gyp",
+        TripleQuotes | Decorators,
+        "#", "\"'", "", "", "u b r ur br", "def class",
+        "and elif is global as in if from raise for except finally print import "
+        "pass return exec else break not with class assert yield try while continue "
+        "del or def lambda async await nonlocal None True False",
+        "Ellipsis NotImplemented",
+        ""
+    },
+    {
+        "bash sh zsh",
+        ShellSyntax | NoNumbers,
+        "#", "\"'", "\"'", "'", "", "",
+        "if then else elif fi for while in do done case esac function",
+        "break cd continue eval exec exit export getopts hash pwd readonly return "
+        "shift test times trap umask unset alias bind builtin caller command declare "
+        "echo enable help let local logout mapfile printf read readarray source type "
+        "typeset ulimit unalias set shopt autoload bg bindkey bye cap chdir clone "
+        "comparguments compcall compctl compdescribe compfiles compgroups compquote "
+        "comptags comptry compvalues dirs disable disown echotc echoti emulate fc fg "
+        "float functions getcap getln history integer jobs kill limit log noglob "
+        "popd print pushd pushln rehash sched setcap setopt stat suspend ttyctl "
+        "unfunction unhash unlimit unsetopt vared wait whence where which zcompile "
+        "zformat zftp zle zmodload zparseopts zprof zpty zregexparse zsocket zstyle "
+        "ztcp",
+        "true false"
+    },
+    {
+        "json",
+        KeyStrings | SignedNumbers,
+        NULL, "\"", "", "", "", "",
+        "",
+        "",
+        "true false null"
+    },
+    {
+        "yaml yml",
+        CaseInsensitive | YamlSyntax | SignedNumbers,
+        "#", "'\"", "'\"", "", "", "",
+        "",
+        "",
+        "true false yes no null"
+    },
+    {
+        "sql",
+        CaseInsensitive | BlockComments | DoubledQuotes | SignedNumbers,
+        "--", "'\"`", "'\"`", "", "", "",
+        "abort add all alter analyze and any as asc attach autoincrement backup "
+        "before begin between by call cascade case cast check coalesce collate "
+        "column commit constraint count create cross current current_date "
+        "current_time current_timestamp cursor database declare default deferred "
+        "delete desc describe distinct do drop each else end escape except exclusive "
+        "execute exists explain fetch for foreign from full function grant group "
+        "having if ignore in index inner insert instead intersect into is join key "
+        "left like limit lock max merge min natural not of offset on or order outer "
+        "over partition pragma primary procedure references rename replace restrict "
+        "returning revoke right rollback row rows savepoint schema select set show "
+        "sum table temp temporary then to transaction trigger truncate union unique "
+        "update use using values view when where while with",
+        "array bigint binary bit blob boolean char character date dec decimal float "
+        "int int8 integer interval number numeric real record serial serial8 "
+        "smallint text varchar varying void",
+        "true false null"
+    },
+    {
+        "go golang",
+        BlockComments | SignedNumbers,
+        "//", "\"'`", "`", "`", "", "func",
+        "break default func interface select case map struct chan else goto package "
+        "switch const fallthrough if range type continue for import return var go "
+        "defer bool byte complex64 complex128 float32 float64 int8 int16 int32 int64 "
+        "string uint8 uint16 uint32 uint64 int uint uintptr rune",
+        "append cap close complex copy imag len make new panic print println real "
+        "recover delete",
+        "true false iota nil"
+    }
+};
+
+// Keywords of preprocessor directives of C.
+static const char *c_directiveKeywords = "if else elif endif define undef warning "
+                                         "error line pragma ifdef ifndef include";
+
+static QStringList splitWords(const char *p_words)
+{
+    return QString(p_words).split(' ', QString::SkipEmptyParts);
+}
+
+struct Lexer
+{
+    const LexerDef *m_def;
+
+    // Style of each word.
+    QHash<QString, int> m_words;
+
+    QSet<QString> m_titleKeywords;
+
+    QSet<QString> m_stringPrefixes;
+};
+
+// All the lexers, built once.
+struct LexerTable
+{
+    LexerTable();
+
+    QVector<Lexer> m_lexers;
+
+    // Index of lexer of each language name.
+    QHash<QString, int> m_names;
+
+    QSet<QString> m_directiveKeywords;
+
+    QString m_styles[NumOfTokenStyles];
+};
+
+LexerTable::LexerTable()
+{
+    int nrLexers = sizeof(c_lexerDefs) / sizeof(c_lexerDefs[0]);
+    m_lexers.resize(nrLexers);
+    for (int i = 0; i < nrLexers; ++i) {
+        const LexerDef &def = c_lexerDefs[i];
+        Lexer &lexer = m_lexers[i];
+        lexer.m_def = &def;
+
+        bool caseInsensitive = def.m_flags & CaseInsensitive;
+        const char *words[] = { def.m_keywords, def.m_builtIns, def.m_literals };
+        const TokenStyle styles[] = { KeywordStyle, BuiltInStyle, LiteralStyle };
+        for (int j = 0; j < 3; ++j) {
+            for (auto const &word : splitWords(words[j])) {
+                lexer.m_words.insert(caseInsensitive ? word.toLower() : word, styles[j]);
+            }
+        }
+
+        lexer.m_titleKeywords = splitWords(def.m_titleKeywords).toSet();
+        lexer.m_stringPrefixes = splitWords(def.m_stringPrefixes).toSet();
+
+        for (auto const &name : splitWords(def.m_names)) {
+            m_names.insert(name, i);
+        }
+    }
+
+    m_directiveKeywords = splitWords(c_directiveKeywords).toSet();
+
+    for (int i = 0; i < NumOfTokenStyles; ++i) {
+        m_styles[i] = c_styleNames[i];
+    }
+}
+
+static const LexerTable &lexerTable()
+{
+    static const LexerTable table;
+    return table;
+}
+
+static const Lexer *findLexer(const QString &p_lang)
+{
+    const LexerTable &table = lexerTable();
+    auto it = table.m_names.find(p_lang.toLower());
+    if (it == table.m_names.end()) {
+        return NULL;
+    }
+
+    return &table.m_lexers[it.value()];
+}
+
+static inline bool isDigit(ushort p_ch)
+{
+    return p_ch >= '0' && p_ch <= '9';
+}
+
+static inline bool isWordStart(ushort p_ch)
+{
+    if (p_ch < 0x80) {
+        return (p_ch >= 'a' && p_ch <= 'z') || (p_ch >= 'A' && p_ch <= 'Z') || p_ch == '_';
+    }
+
+    return QChar(p_ch).isLetter();
+}
+
+static inline bool isWordChar(ushort p_ch)
+{
+    return isWordStart(p_ch) || isDigit(p_ch)
+           || (p_ch >= 0x80 && QChar(p_ch).isLetterOrNumber());
+}
+
+static inline bool isHexDigit(ushort p_ch)
+{
+    return isDigit(p_ch) || (p_ch >= 'a' && p_ch <= 'f') || (p_ch >= 'A' && p_ch <= 'F');
+}
+
+static inline bool containsChar(const char *p_chars, ushort p_ch)
+{
+    for (; *p_chars; ++p_chars) {
+        if ((ushort)*p_chars == p_ch) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Tokenize [@p_start, @p_end) of @p_text in one pass.
+class Tokenizer
+{
+public:
+    Tokenizer(const Lexer &p_lexer, const QString &p_text, int p_start, int p_end,
+              int p_basePos, QList<HLUnitPos> &p_units)
+        : m_lexer(p_lexer), m_table(lexerTable()), m_flags(p_lexer.m_def->m_flags),
+          m_data(p_text.constData()), m_start(p_start), m_end(p_end),
+          m_basePos(p_basePos), m_units(p_units)
+    {
+    }
+
+    void tokenize();
+
+private:
+    // Character at @p_idx, or 0 after the end.
+    ushort at(int p_idx) const
+    {
+        return p_idx < m_end ? m_data[p_idx].unicode() : 0;
+    }
+
+    bool startsWith(int p_idx, const char *p_str) const
+    {
+        for (; *p_str; ++p_str, ++p_idx) {
+            if (at(p_idx) != (ushort)*p_str) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool isLineStart(int p_idx) const
+    {
+        return p_idx == m_start || m_data[p_idx - 1] == QChar('\n');
+    }
+
+    // Index of the '\n' ending the line of @p_idx, or m_end.
+    int lineEnd(int p_idx) const
+    {
+        while (p_idx < m_end && m_data[p_idx] != QChar('\n')) {
+            ++p_idx;
+        }
+
+        return p_idx;
+    }
+
+    int skipSpaces(int p_idx) const
+    {
+        while (at(p_idx) == ' ' || at(p_idx) == '\t') {
+            ++p_idx;
+        }
+
+        return p_idx;
+    }
+
+    void addUnit(int p_start, int p_end, TokenStyle p_style)
+    {
+        if (p_end > p_start) {
+            m_units.append(HLUnitPos(m_basePos + p_start, p_end - p_start,
+                                     m_table.m_styles[p_style]));
+        }
+    }
+
+    // Each lexXXX() lexes a token at @p_idx and returns the index after it,
+    // or @p_idx if there is no such token.
+    int lexLineStart(int p_idx);
+
+    int lexDirective(int p_idx);
+
+    int lexYamlLine(int p_idx);
+
+    // Index after a YAML key at @p_idx, like "name:", or -1.
+    int yamlKeyEnd(int p_idx) const;
+
+    int lexYamlBlockScalar(int p_idx);
+
+    int lexComment(int p_idx);
+
+    // @p_quote: index of the quote, after the prefix of the string.
+    int lexString(int p_idx, int p_quote);
+
+    int lexWord(int p_idx);
+
+    int lexTitle(int p_idx);
+
+    int lexNumber(int p_idx);
+
+    // @p_inString: whether it is within a string, where $(...) is a variable.
+    int lexVariable(int p_idx, bool p_inString);
+
+    const Lexer &m_lexer;
+    const LexerTable &m_table;
+    int m_flags;
+    const QChar *m_data;
+    int m_start;
+    int m_end;
+    int m_basePos;
+    QList<HLUnitPos> &m_units;
+};
+
+void Tokenizer::tokenize()
+{
+    const LexerDef *def = m_lexer.m_def;
+    int idx = m_start;
+    while (idx < m_end) {
+        int next = idx;
+        if (isLineStart(idx)) {
+            next = lexLineStart(idx);
+            if (next > idx) {
+                idx = next;
+                continue;
+            }
+        }
+
+        ushort ch = at(idx);
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            ++idx;
+            continue;
+        }
+
+        if ((m_flags & ShellSyntax) && ch == '$') {
+            next = lexVariable(idx, false);
+        } else if (def->m_lineComment && startsWith(idx, def->m_lineComment)) {
+            next = lineEnd(idx);
+            addUnit(idx, next, CommentStyle);
+        } else if ((m_flags & BlockComments) && startsWith(idx, "/*")) {
+            next = lexComment(idx);
+        } else if (containsChar(def->m_quotes, ch)) {
+            next = lexString(idx, idx);
+        } else if (isWordStart(ch)) {
+            next = lexWord(idx);
+        } else if (!(m_flags & NoNumbers)
+                   && (isDigit(ch)
+                       || (ch == '.' && isDigit(at(idx + 1)))
+                       || ((m_flags & SignedNumbers) && ch == '-'
+                           && (isDigit(at(idx + 1))
+                               || (at(idx + 1) == '.' && isDigit(at(idx + 2))))))) {
+            next = lexNumber(idx);
+        } else if (m_flags & YamlSyntax) {
+            if (ch == '|' || ch == '>') {
+                next = lexYamlBlockScalar(idx);
+            } else if (ch == '!' && at(idx + 1) == '!' && isWordStart(at(idx + 2))) {
+                next = idx + 3;
+                while (isWordChar(at(next))) {
+                    ++next;
+                }
+
+                addUnit(idx, next, TypeStyle);
+            } else if ((ch == '&' || ch == '*') && isWordStart(at(idx + 1))) {
+                // Anchors and aliases at the end of a line.
+                int end = idx + 2;
+                while (isWordChar(at(end))) {
+                    ++end;
+                }
+
+                if (end == lineEnd(idx)) {
+                    addUnit(idx, end, MetaStyle);
+                    next = end;
+                }
+            }
+        }
+
+        idx = next > idx ? next : idx + 1;
+    }
+}
+
+int Tokenizer::lexLineStart(int p_idx)
+{
+    int idx = skipSpaces(p_idx);
+    if ((m_flags & Directives) && at(idx) == '#') {
+        return lexDirective(idx);
+    }
+
+    if ((m_flags & Decorators) && at(idx) == '@') {
+        int end = lineEnd(idx);
+        addUnit(idx, end, MetaStyle);
+        return end;
+    }
+
+    if ((m_flags & ShellSyntax) && startsWith(p_idx, "#!")) {
+        int end = lineEnd(p_idx);
+        QString line = QString::fromRawData(m_data + p_idx, end - p_idx).trimmed();
+        if (line.endsWith("sh")) {
+            addUnit(p_idx, end, MetaStyle);
+            return end;
+        }
+    }
+
+    if (m_flags & YamlSyntax) {
+        return lexYamlLine(p_idx);
+    }
+
+    return p_idx;
+}
+
+int Tokenizer::lexDirective(int p_idx)
+{
+    int idx = skipSpaces(p_idx + 1);
+    if (!(at(idx) >= 'a' && at(idx) <= 'z')) {
+        return p_idx;
+    }
+
+    // Lines ending with '\' are continued.
+    int end = lineEnd(idx);
+    while (end < m_end && m_data[end - 1] == QChar('\\')) {
+        end = lineEnd(end + 1);
+    }
+
+    addUnit(p_idx, end, MetaStyle);
+
+    while (idx < end) {
+        ushort ch = at(idx);
+        int next = idx + 1;
+        if (isWordStart(ch)) {
+            while (isWordChar(at(next))) {
+                ++next;
+            }
+
+            QString word = QString::fromRawData(m_data + idx, next - idx);
+            if (m_table.m_directiveKeywords.contains(word)) {
+                addUnit(idx, next, MetaKeywordStyle);
+            }
+        } else if (ch == '"' || ch == '<') {
+            ushort quote = ch == '"' ? '"' : '>';
+            while (next < end && at(next) != quote && at(next) != '\n') {
+                next += (ch == '"' && at(next) == '\\') ? 2 : 1;
+            }
+
+            if (at(next) == quote) {
+                ++next;
+                addUnit(idx, next, MetaStringStyle);
+            } else if (ch == '<') {
+                // Not a <file>.
+                next = idx + 1;
+            } else {
+                addUnit(idx, next, MetaStringStyle);
+            }
+        } else if (startsWith(idx, "//")) {
+            next = lineEnd(idx);
+            addUnit(idx, next, CommentStyle);
+        } else if (startsWith(idx, "/*")) {
+            next = lexComment(idx);
+        }
+
+        idx = next;
+    }
+
+    return qMax(end, idx);
+}
+
+int Tokenizer::yamlKeyEnd(int p_idx) const
+{
+    int idx = p_idx;
+    ushort quote = at(idx);
+    if (quote == '"' || quote == '\'') {
+        ++idx;
+    } else {
+        quote = 0;
+    }
+
+    if (!(isWordStart(at(idx)) && at(idx) < 0x80)) {
+        return -1;
+    }
+
+    ++idx;
+    while (at(idx) < 0x80 && (isWordChar(at(idx)) || at(idx) == '-')) {
+        ++idx;
+    }
+
+    if (quote) {
+        if (at(idx) != quote) {
+            return -1;
+        }
+
+        ++idx;
+    }
+
+    return at(idx) == ':' ? idx + 1 : -1;
+}
+
+int Tokenizer::lexYamlLine(int p_idx)
+{
+    // Keys, including the leading spaces and bullets.
+    int idx = p_idx;
+    while (at(idx) == ' ' || at(idx) == '-') {
+        ++idx;
+    }
+
+    int end = yamlKeyEnd(idx);
+    if (end != -1) {
+        addUnit(p_idx, end, AttrStyle);
+        return end;
+    }
+
+    if (startsWith(p_idx, "---")) {
+        end = lineEnd(p_idx);
+        if (skipSpaces(p_idx + 3) == end) {
+            addUnit(p_idx, end, MetaStyle);
+            return end;
+        }
+    }
+
+    idx = p_idx;
+    while (at(idx) == ' ') {
+        ++idx;
+    }
+
+    if (at(idx) == '-') {
+        addUnit(p_idx, idx + 1, BulletStyle);
+        return idx + 1;
+    }
+
+    return p_idx;
+}
+
+int Tokenizer::lexYamlBlockScalar(int p_idx)
+{
+    int end = lineEnd(p_idx);
+    if (skipSpaces(p_idx + 1) != end) {
+        return p_idx;
+    }
+
+    // Till next key.
+    while (end < m_end) {
+        int idx = end + 1;
+        while (at(idx) == ' ' || at(idx) == '-') {
+            ++idx;
+        }
+
+        if (yamlKeyEnd(idx) != -1) {
+            break;
+        }
+
+        end = lineEnd(end + 1);
+    }
+
+    addUnit(p_idx, end, StringStyle);
+    return end;
+}
+
+int Tokenizer::lexComment(int p_idx)
+{
+    int end = p_idx + 2;
+    while (end < m_end && !startsWith(end, "*/")) {
+        ++end;
+    }
+
+    end = qMin(end + 2, m_end);
+    addUnit(p_idx, end, CommentStyle);
+    return end;
+}
+
+int Tokenizer::lexString(int p_idx, int p_quote)
+{
+    const LexerDef *def = m_lexer.m_def;
+    ushort quote = at(p_quote);
+    bool multiLine = containsChar(def->m_multiLineQuotes, quote);
+    bool raw = containsChar(def->m_rawQuotes, quote);
+    bool triple = (m_flags & TripleQuotes) && at(p_quote + 1) == quote && at(p_quote + 2) == quote;
+    bool withVariables = (m_flags & ShellSyntax) && quote == '"';
+
+    int idx = p_quote + (triple ? 3 : 1);
+    while (idx < m_end) {
+        ushort ch = at(idx);
+        if (ch == '\\' && !raw) {
+            idx += 2;
+            continue;
+        }
+
+        if (ch == '\n' && !multiLine && !triple) {
+            break;
+        }
+
+        if (ch == quote) {
+            if (triple) {
+                if (startsWith(idx + 1, quote == '"' ? "\"\"" : "''")) {
+                    idx += 3;
+                    break;
+                }
+            } else if ((m_flags & DoubledQuotes) && at(idx + 1) == quote) {
+                ++idx;
+            } else {
+                ++idx;
+                break;
+            }
+        } else if (withVariables && ch == '$') {
+            int next = lexVariable(idx, true);
+            if (next > idx) {
+                idx = next;
+                continue;
+            }
+        }
+
+        ++idx;
+    }
+
+    idx = qMin(idx, m_end);
+    TokenStyle style = StringStyle;
+    if ((m_flags & KeyStrings) && at(skipSpaces(idx)) == ':') {
+        style = AttrStyle;
+    }
+
+    addUnit(p_idx, idx, style);
+    return idx;
+}
+
+int Tokenizer::lexWord(int p_idx)
+{
+    int end = p_idx + 1;
+    while (isWordChar(at(end))) {
+        ++end;
+    }
+
+    QString word = QString::fromRawData(m_data + p_idx, end - p_idx);
+    if (containsChar(m_lexer.m_def->m_quotes, at(end))
+        && m_lexer.m_stringPrefixes.contains(word)) {
+        return lexString(p_idx, end);
+    }
+
+    if (m_flags & CaseInsensitive) {
+        word = word.toLower();
+    }
+
+    int style = m_lexer.m_words.value(word, -1);
+    if (style == -1) {
+        if ((m_flags & TypeNames) && word.endsWith("_t")) {
+            addUnit(p_idx, end, KeywordStyle);
+        }
+
+        return end;
+    }
+
+    addUnit(p_idx, end, (TokenStyle)style);
+    if (m_lexer.m_titleKeywords.contains(word)) {
+        return lexTitle(end);
+    }
+
+    return end;
+}
+
+int Tokenizer::lexTitle(int p_idx)
+{
+    int idx = skipSpaces(p_idx);
+    // Receiver of a method of Go, like func (p *T) name().
+    if (at(idx) == '(') {
+        int end = lineEnd(idx);
+        while (idx < end && at(idx) != ')') {
+            ++idx;
+        }
+
+        idx = skipSpaces(idx + 1);
+    }
+
+    if (!isWordStart(at(idx))) {
+        return p_idx;
+    }
+
+    int end = idx + 1;
+    while (isWordChar(at(end))) {
+        ++end;
+    }
+
+    addUnit(idx, end, TitleStyle);
+    return end;
+}
+
+int Tokenizer::lexNumber(int p_idx)
+{
+    int idx = p_idx;
+    if (at(idx) == '-') {
+        ++idx;
+    }
+
+    if (at(idx) == '0' && (at(idx + 1) == 'x' || at(idx + 1) == 'X')) {
+        idx += 2;
+        while (isHexDigit(at(idx))) {
+            ++idx;
+        }
+    } else {
+        while (isDigit(at(idx))) {
+            ++idx;
+        }
+
+        if (at(idx) == '.') {
+            ++idx;
+            while (isDigit(at(idx))) {
+                ++idx;
+            }
+        }
+
+        if ((at(idx) == 'e' || at(idx) == 'E')
+            && (isDigit(at(idx + 1))
+                || ((at(idx + 1) == '+' || at(idx + 1) == '-') && isDigit(at(idx + 2))))) {
+            idx += 2;
+            while (isDigit(at(idx))) {
+                ++idx;
+            }
+        }
+    }
+
+    // Suffixes, like 10UL and 1.5f.
+    while (isWordChar(at(idx))) {
+        ++idx;
+    }
+
+    addUnit(p_idx, idx, NumberStyle);
+    return idx;
+}
+
+int Tokenizer::lexVariable(int p_idx, bool p_inString)
+{
+    ushort ch = at(p_idx + 1);
+    int end = p_idx;
+    if (ch == '{' || (ch == '(' && p_inString)) {
+        ushort close = ch == '{' ? '}' : ')';
+        int idx = p_idx + 2;
+        int lineEndIdx = lineEnd(idx);
+        while (idx < lineEndIdx && at(idx) != close) {
+            ++idx;
+        }
+
+        if (idx < lineEndIdx) {
+            end = idx + 1;
+        }
+    } else if (isWordChar(ch) || ch == '#' || ch == '@') {
+        end = p_idx + 2;
+        while (isWordChar(at(end))) {
+            ++end;
+        }
+    }
+
+    addUnit(p_idx, end, VariableStyle);
+    return end;
+}
+
+bool HGCodeBlockTokenizer::supportsLanguage(const QString &p_lang)
+{
+    return findLexer(p_lang) != NULL;
+}
+
+bool HGCodeBlockTokenizer::tokenize(const VCodeBlock &p_block, QList<HLUnitPos> &p_units)
+{
+    const Lexer *lexer = findLexer(p_block.m_lang);
+    if (!lexer) {
+        return false;
+    }
+
+    // Skip the fence lines.
+    const QString &text = p_block.m_text;
+    int start = text.indexOf('\n') + 1;
+    int end = text.lastIndexOf('\n');
+    if (start == 0 || start >= end) {
+        return true;
+    }
+
+    Tokenizer(*lexer, text, start, end, p_block.m_startPos, p_units).tokenize();
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef HGCODEBLOCKTOKENIZER_H
+#define HGCODEBLOCKTOKENIZER_H
+
+#include <QList>
+#include <QString>
+
+struct VCodeBlock;
+struct HLUnitPos;
+
+// Tokenize fenced code blocks of common languages natively, without the web
+// page. Lexers are driven by tables of keywords and a few flags per language,
+// following the grammars of highlight.js used in read mode. Highlight units
+// are styled with the class names of highlight.js, like "hljs-keyword", which
+// are the keys of the code block styles of the editor.
+namespace HGCodeBlockTokenizer
+{
+    // Whether there is a native lexer for @p_lang, the language of a fence,
+    // such as "cpp" or "py".
+    bool supportsLanguage(const QString &p_lang);
+
+    // Tokenize the code of complete fenced code block @p_block, excluding the
+    // fence lines, and append the highlight units to @p_units.
+    // Return false if its language is not supported.
+    bool tokenize(const VCodeBlock &p_block, QList<HLUnitPos> &p_units);
+}
+
+#endif // HGCODEBLOCKTOKENIZER_H
@@ -1,38 +1,25 @@
 #include <QtGui>
 #include <QtDebug>
 #include <QTextCursor>
+#include <QThread>
 #include <algorithm>
 #include "hgmarkdownhighlighter.h"
+#include "hgmarkdownparser.h"
 #include "vconfigmanager.h"
 
 extern VConfigManager vconfig;
 
-const int HGMarkdownHighlighter::initCapacity = 1024;
-
-void HGMarkdownHighlighter::resizeBuffer(int newCap)
-{
-    if (newCap == capacity) {
-        return;
-    }
-    if (capacity > 0) {
-        Q_ASSERT(content);
-        delete [] content;
-    }
-    capacity = newCap;
-    content = new char [capacity];
-}
-
 // Will be freeed by parent automatically
 HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &styles,
                                              const QHash<QString, QTextCharFormat> &codeBlockStyles,
                                              int waitInterval,
                                              QTextDocument *parent)
-    : QSyntaxHighlighter(parent), highlightingStyles(styles),
-      m_codeBlockStyles(codeBlockStyles), m_numOfCodeBlockHighlightsToRecv(0),
-      parsing(0), waitInterval(waitInterval), content(NULL), capacity(0), result(NULL)
+    : QSyntaxHighlighter(static_cast<QObject *>(parent)), highlightingStyles(styles),
+      m_codeBlockTimeStamp(-1), m_commentRegionHint(0), waitInterval(waitInterval),
+      m_timeStamp(0), m_dirtyStartBlock(-1), m_dirtyTailBlocks(0),
+      m_firstVisibleBlock(0), m_lastVisibleBlock(-1), m_codeBlockIndexValid(false),
+      m_nextCodeBlockId(0), m_codeBlocksDirtyStart(-1), m_codeBlocksDirtyTail(0)
 {
-    codeBlockStartExp = QRegExp("^\\s*```(\\S*)");
-    codeBlockEndExp = QRegExp("^\\s*```$");
     codeBlockFormat.setForeground(QBrush(Qt::darkYellow));
     for (int index = 0; index < styles.size(); ++index) {
         const pmh_element_type &eleType = styles[index].type;
@@ -45,9 +32,25 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
         }
     }
 
-    resizeBuffer(initCapacity);
+    for (auto it = codeBlockStyles.begin(); it != codeBlockStyles.end(); ++it) {
+        if (m_codeBlockStyleFormats.size() == c_maxNumOfCodeBlockStyles) {
+            qWarning() << "too many code block styles, ignore" << it.key();
+            continue;
+        }
+
+        m_codeBlockStyleIds.insert(it.key(), m_codeBlockStyleFormats.size());
+        m_codeBlockStyleFormats.append(it.value());
+    }
+
     document = parent;
 
+    m_parser = new HGMarkdownParser(highlightingStyles);
+    m_parserThread = new QThread(this);
+    m_parser->moveToThread(m_parserThread);
+    connect(m_parser, &HGMarkdownParser::parseFinished,
+            this, &HGMarkdownHighlighter::handleParseFinished);
+    m_parserThread->start();
+
     timer = new QTimer(this);
     timer->setSingleShot(true);
     timer->setInterval(this->waitInterval);
@@ -60,32 +63,38 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
     connect(m_completeTimer, &QTimer::timeout,
             this, &HGMarkdownHighlighter::highlightCompleted);
 
+    m_rehighlightTimer = new QTimer(this);
+    m_rehighlightTimer->setInterval(0);
+    connect(m_rehighlightTimer, &QTimer::timeout,
+            this, &HGMarkdownHighlighter::rehighlightPendingBlocks);
+
+    // Connect before QSyntaxHighlighter does, so the data of blocks will be
+    // adjusted before QSyntaxHighlighter re-highlights the changed blocks.
     connect(document, &QTextDocument::contentsChange,
             this, &HGMarkdownHighlighter::handleContentChange);
+
+    setDocument(document);
 }
 
 HGMarkdownHighlighter::~HGMarkdownHighlighter()
 {
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
-    }
-    if (content) {
-        delete [] content;
-        capacity = 0;
-        content = NULL;
-    }
+    // Abandon any parse in progress.
+    m_parser->invalidate(++m_timeStamp);
+
+    m_parserThread->quit();
+    m_parserThread->wait();
+
+    delete m_parser;
+    m_parser = NULL;
 }
 
 void HGMarkdownHighlighter::highlightBlock(const QString &text)
 {
     int blockNum = currentBlock().blockNumber();
-    if (!parsing && blockHighlights.size() > blockNum) {
-        const QVector<HLUnit> &units = blockHighlights[blockNum];
-        for (int i = 0; i < units.size(); ++i) {
-            // TODO: merge two format within the same range
-            const HLUnit &unit = units[i];
-            setFormat(unit.start, unit.length, highlightingStyles[unit.styleIndex].format);
+    if (blockHighlights.size() > blockNum) {
+        const QVector<HLFormatRun> &runs = blockHighlights[blockNum];
+        for (auto const &run : runs) {
+            setFormat(run.m_start, run.m_length, m_formats[run.m_formatIndex]);
         }
     }
 
@@ -98,44 +107,23 @@ void HGMarkdownHighlighter::highlightBlock(const QString &text)
         goto exit;
     }
 
+    {
+    bool inCodeBlock = previousBlockState() == HighlightBlockState::CodeBlock;
+    HGMarkdownScanner::scanBlock(text, inCodeBlock, true, m_scanResult);
+
     // PEG Markdown Highlight does not handle the ``` code block correctly.
     setCurrentBlockState(HighlightBlockState::Normal);
-    highlightCodeBlock(text);
+    highlightCodeBlock(text, inCodeBlock);
 
     // PEG Markdown Highlight does not handle links with spaces in the URL.
-    highlightLinkWithSpacesInURL(text);
+    highlightLinkWithSpacesInURL();
+    }
 
     // Highlight CodeBlock using VCodeBlockHighlightHelper.
     if (m_codeBlockHighlights.size() > blockNum) {
-        const QVector<HLUnitStyle> &units = m_codeBlockHighlights[blockNum];
-        // Manually simply merge the format of all the units within the same block.
-        // Using QTextCursor to get the char format after setFormat() seems
-        // not to work.
-        QVector<QTextCharFormat> formats;
-        formats.reserve(units.size());
-        // formatIndex[i] is the index in @formats which is the format of the
-        // ith character.
-        QVector<int> formatIndex(currentBlock().length(), -1);
-        for (int i = 0; i < units.size(); ++i) {
-            const HLUnitStyle &unit = units[i];
-            auto it = m_codeBlockStyles.find(unit.style);
-            if (it != m_codeBlockStyles.end()) {
-                QTextCharFormat newFormat;
-                if (unit.start < (unsigned int)formatIndex.size() && formatIndex[unit.start] != -1) {
-                    newFormat = formats[formatIndex[unit.start]];
-                    newFormat.merge(*it);
-                } else {
-                    newFormat = *it;
-                }
-                setFormat(unit.start, unit.length, newFormat);
-
-                formats.append(newFormat);
-                int idx = formats.size() - 1;
-                unsigned int endIdx = unit.length + unit.start;
-                for (unsigned int i = unit.start; i < endIdx && i < (unsigned int)formatIndex.size(); ++i) {
-                    formatIndex[i] = idx;
-                }
-            }
+        const QVector<HLFormatRun> &runs = m_codeBlockHighlights[blockNum];
+        for (auto const &run : runs) {
+            setFormat(run.m_start, run.m_length, m_codeBlockFormats[run.m_formatIndex]);
         }
     }
 
@@ -143,273 +131,711 @@ exit:
     highlightChanged();
 }
 
-void HGMarkdownHighlighter::initBlockHighlightFromResult(int nrBlocks)
+void HGMarkdownHighlighter::highlightCodeBlock(const QString &text, bool p_inCodeBlock)
 {
-    blockHighlights.resize(nrBlocks);
-    for (int i = 0; i < blockHighlights.size(); ++i) {
-        blockHighlights[i].clear();
+    if (!HGMarkdownScanner::isCodeBlockLine(m_scanResult, p_inCodeBlock)) {
+        return;
     }
 
-    if (!result) {
-        return;
+    if (HGMarkdownScanner::continuesCodeBlock(m_scanResult, p_inCodeBlock)) {
+        setCurrentBlockState(HighlightBlockState::CodeBlock);
     }
 
-    for (int i = 0; i < highlightingStyles.size(); i++)
-    {
-        const HighlightingStyle &style = highlightingStyles[i];
-        pmh_element *elem_cursor = result[style.type];
-        while (elem_cursor != NULL)
-        {
-            // elem_cursor->pos and elem_cursor->end is the start
-            // and end position of the element in document.
-            if (elem_cursor->end <= elem_cursor->pos) {
-                elem_cursor = elem_cursor->next;
-                continue;
-            }
-            initBlockHighlihgtOne(elem_cursor->pos, elem_cursor->end, i);
-            elem_cursor = elem_cursor->next;
+    setFormat(0, text.length(), codeBlockFormat);
+}
+
+void HGMarkdownHighlighter::highlightLinkWithSpacesInURL()
+{
+    for (auto const &link : m_scanResult.m_links) {
+        if (link.m_isImage && m_imageFormat.isValid()) {
+            setFormat(link.m_start, link.m_length, m_imageFormat);
+        } else if (m_linkFormat.isValid()) {
+            setFormat(link.m_start, link.m_length, m_linkFormat);
         }
     }
 }
 
-void HGMarkdownHighlighter::initHtmlCommentRegionsFromResult()
+void HGMarkdownHighlighter::parse(bool p_full)
 {
-    m_commentRegions.clear();
+    int nrBlocks = document->blockCount();
+    int startBlock = 0;
+    int lastBlock = nrBlocks - 1;
 
-    if (!result) {
-        return;
+    if (m_dirtyStartBlock == -1
+        || blockHighlights.size() != nrBlocks
+        || m_blocksFlags.size() != nrBlocks) {
+        p_full = true;
     }
 
-    pmh_element *elem = result[pmh_COMMENT];
-    while (elem != NULL) {
-        if (elem->end <= elem->pos) {
-            elem = elem->next;
-            continue;
+    if (!p_full) {
+        startBlock = qMin(m_dirtyStartBlock, nrBlocks - 1);
+        lastBlock = qMax(nrBlocks - 1 - m_dirtyTailBlocks, startBlock);
+
+        // Widen [startBlock, lastBlock] to safe boundaries.
+        QTextBlock block = document->findBlockByNumber(startBlock);
+        while (startBlock > 0 && !isSafeBoundary(block, startBlock)) {
+            block = block.previous();
+            --startBlock;
         }
 
-        m_commentRegions.push_back(VCommentRegion(elem->pos, elem->end));
+        block = document->findBlockByNumber(lastBlock + 1);
+        while (block.isValid() && !isSafeBoundary(block, lastBlock + 1)) {
+            block = block.next();
+            ++lastBlock;
+        }
 
-        elem = elem->next;
+        // Not worth a partial parse.
+        if (lastBlock - startBlock + 1 > nrBlocks / 2) {
+            p_full = true;
+        }
     }
 
-    qDebug() << "highlighter:" << m_commentRegions.size() << "HTML comment regions";
+    HGParseRequest req;
+    req.m_timeStamp = m_timeStamp;
+    if (p_full) {
+        req.m_text = document->toPlainText();
+    } else {
+        req.m_startBlock = startBlock;
+        req.m_numOfTailBlocks = nrBlocks - 1 - lastBlock;
+        req.m_text = textOfBlocks(startBlock, lastBlock);
+
+        // A HTML comment may start or end within the dirty blocks and cross
+        // the boundaries.
+        if (req.m_text.count("<!--") != req.m_text.count("-->")) {
+            parse(true);
+            return;
+        }
+
+        req.m_references = referencesOutsideBlocks(startBlock, req.m_numOfTailBlocks);
+    }
+
+    m_parser->requestParse(req);
 }
 
-void HGMarkdownHighlighter::initBlockHighlihgtOne(unsigned long pos, unsigned long end, int styleIndex)
+bool HGMarkdownHighlighter::isSafeBoundary(const QTextBlock &p_block, int p_blockNum) const
 {
-    int startBlockNum = document->findBlock(pos).blockNumber();
-    int endBlockNum = document->findBlock(end).blockNumber();
-    for (int i = startBlockNum; i <= endBlockNum; ++i)
-    {
-        QTextBlock block = document->findBlockByNumber(i);
-        int blockStartPos = block.position();
-        HLUnit unit;
-        if (i == startBlockNum) {
-            unit.start = pos - blockStartPos;
-            unit.length = (startBlockNum == endBlockNum) ?
-                          (end - pos) : (block.length() - unit.start);
-        } else if (i == endBlockNum) {
-            unit.start = 0;
-            unit.length = end - blockStartPos;
-        } else {
-            unit.start = 0;
-            unit.length = block.length();
-        }
-        unit.styleIndex = styleIndex;
+    if (p_blockNum == 0) {
+        return true;
+    }
 
-        blockHighlights[i].append(unit);
+    if (p_blockNum < 0 || p_blockNum >= m_blocksFlags.size()) {
+        return false;
+    }
+
+    if (m_blocksFlags[p_blockNum] & HighlightBlockFlag::ContinuedElement) {
+        return false;
+    }
+
+    // Current block should start a top-level element.
+    QString text = p_block.text();
+    if (text.isEmpty() || text[0].isSpace()) {
+        return false;
+    }
+
+    // Previous block should be an empty line outside fenced code blocks
+    // and HTML comments.
+    QTextBlock preBlock = p_block.previous();
+    int state = preBlock.userState();
+    if (state == HighlightBlockState::CodeBlock
+        || state == HighlightBlockState::Comment) {
+        return false;
     }
+
+    return preBlock.text().trimmed().isEmpty();
 }
 
-void HGMarkdownHighlighter::highlightCodeBlock(const QString &text)
+QString HGMarkdownHighlighter::textOfBlocks(int p_first, int p_last) const
 {
-    int nextIndex = 0;
-    int startIndex = 0;
-    if (previousBlockState() != HighlightBlockState::CodeBlock) {
-        startIndex = codeBlockStartExp.indexIn(text);
-        if (startIndex >= 0) {
-            nextIndex = startIndex + codeBlockStartExp.matchedLength();
-        } else {
-            nextIndex = -1;
+    QString text;
+    QTextBlock block = document->findBlockByNumber(p_first);
+    for (int i = p_first; i <= p_last && block.isValid(); ++i) {
+        if (i > p_first) {
+            text.append('\n');
         }
+
+        text.append(block.text());
+        block = block.next();
     }
 
-    while (nextIndex >= 0) {
-        int endIndex = codeBlockEndExp.indexIn(text, nextIndex);
-        int codeBlockLength;
-        if (endIndex == -1) {
-            setCurrentBlockState(HighlightBlockState::CodeBlock);
-            codeBlockLength = text.length() - startIndex;
-        } else {
-            codeBlockLength = endIndex - startIndex + codeBlockEndExp.matchedLength();
+    // Keep consistent with QTextDocument::toPlainText().
+    text.replace(QChar::Nbsp, ' ');
+    return text;
+}
+
+QString HGMarkdownHighlighter::referencesOutsideBlocks(int p_first, int p_tailBlocks) const
+{
+    QString text;
+    int nrBlocks = m_blocksFlags.size();
+    int tailStart = qMax(nrBlocks - p_tailBlocks, p_first);
+    for (int i = 0; i < nrBlocks; ++i) {
+        if (i == p_first) {
+            // Jump to the tail.
+            i = tailStart;
+            if (i >= nrBlocks) {
+                break;
+            }
         }
-        setFormat(startIndex, codeBlockLength, codeBlockFormat);
-        startIndex = codeBlockStartExp.indexIn(text, startIndex + codeBlockLength);
-        if (startIndex >= 0) {
-            nextIndex = startIndex + codeBlockStartExp.matchedLength();
-        } else {
-            nextIndex = -1;
+
+        if (m_blocksFlags[i] & HighlightBlockFlag::ReferenceDefinition) {
+            QTextBlock block = document->findBlockByNumber(i);
+            text.append(block.text());
+            text.append('\n');
         }
     }
+
+    return text;
 }
 
-void HGMarkdownHighlighter::highlightLinkWithSpacesInURL(const QString &p_text)
+void HGMarkdownHighlighter::handleContentChange(int position, int charsRemoved, int charsAdded)
 {
-    if (currentBlockState() == HighlightBlockState::CodeBlock) {
+    if (charsRemoved == 0 && charsAdded == 0) {
         return;
     }
-    // TODO: should select links with spaces in URL.
-    QRegExp regExp("[\\!]?\\[[^\\]]*\\]\\(([^\\n\\)]+)\\)");
-    int index = regExp.indexIn(p_text);
-    while (index >= 0) {
-        Q_ASSERT(regExp.captureCount() == 1);
-        int length = regExp.matchedLength();
-        QString capturedText = regExp.capturedTexts()[1];
-        if (capturedText.contains(' ')) {
-            if (p_text[index] == '!' && m_imageFormat.isValid()) {
-                setFormat(index, length, m_imageFormat);
-            } else if (m_linkFormat.isValid()) {
-                setFormat(index, length, m_linkFormat);
+
+    // Any parse in progress is obsolete now, and will be cancelled.
+    m_parser->invalidate(++m_timeStamp);
+
+    // Track the dirty blocks.
+    int nrBlocks = document->blockCount();
+    int firstBlock = document->findBlock(position).blockNumber();
+    QTextBlock lastBlock = document->findBlock(position + charsAdded);
+    int tailBlocks = lastBlock.isValid() ? nrBlocks - 1 - lastBlock.blockNumber() : 0;
+    if (firstBlock == -1) {
+        firstBlock = 0;
+    }
+
+    adjustBlocksData(position, charsRemoved, charsAdded, firstBlock);
+
+    if (m_dirtyStartBlock == -1) {
+        m_dirtyStartBlock = firstBlock;
+        m_dirtyTailBlocks = tailBlocks;
+    } else {
+        m_dirtyStartBlock = qMin(m_dirtyStartBlock, firstBlock);
+        m_dirtyTailBlocks = qMin(m_dirtyTailBlocks, tailBlocks);
+    }
+
+    if (m_codeBlocksDirtyStart == -1) {
+        m_codeBlocksDirtyStart = firstBlock;
+        m_codeBlocksDirtyTail = tailBlocks;
+    } else {
+        m_codeBlocksDirtyStart = qMin(m_codeBlocksDirtyStart, firstBlock);
+        m_codeBlocksDirtyTail = qMin(m_codeBlocksDirtyTail, tailBlocks);
+    }
+
+    timer->stop();
+    timer->start();
+}
+
+void HGMarkdownHighlighter::timerTimeout()
+{
+    parse();
+}
+
+// Keep @p_data aligned with the blocks after blocks right after @p_firstBlock
+// are inserted or removed.
+template <typename T>
+static void insertOrRemoveBlocks(QVector<T> &p_data, int p_firstBlock, int p_nrBlocks)
+{
+    int delta = p_nrBlocks - p_data.size();
+    if (p_data.isEmpty() || delta == 0) {
+        return;
+    }
+
+    int idx = qMin(p_firstBlock + 1, p_data.size());
+    if (delta > 0) {
+        p_data.insert(idx, delta, T());
+    } else {
+        p_data.remove(idx, qMin(-delta, p_data.size() - idx));
+    }
+}
+
+void HGMarkdownHighlighter::adjustBlocksData(int p_position, int p_charsRemoved,
+                                             int p_charsAdded, int p_firstBlock)
+{
+    int nrBlocks = document->blockCount();
+    int blocksDelta = nrBlocks - blockHighlights.size();
+
+    insertOrRemoveBlocks(blockHighlights, p_firstBlock, nrBlocks);
+    insertOrRemoveBlocks(m_blocksFlags, p_firstBlock, nrBlocks);
+    insertOrRemoveBlocks(m_codeBlockHighlights, p_firstBlock, nrBlocks);
+
+    int delta = p_charsAdded - p_charsRemoved;
+    for (auto &reg : m_commentRegions) {
+        if (reg.m_startPos >= p_position + p_charsRemoved) {
+            reg.m_startPos += delta;
+            reg.m_endPos += delta;
+        } else if (reg.m_endPos >= p_position) {
+            // Keep the regions sorted.
+            reg.m_startPos = qMin(reg.m_startPos, p_position);
+            reg.m_endPos = qMax(reg.m_endPos + delta, p_position);
+        }
+    }
+
+    if (blocksDelta != 0) {
+        for (auto &blockNum : m_blocksToRehighlight) {
+            if (blockNum > p_firstBlock) {
+                blockNum = qMax(blockNum + blocksDelta, p_firstBlock);
+            }
+        }
+
+        // Code blocks touched by the change will be re-scanned.
+        for (auto &entry : m_codeBlockIndex) {
+            if (entry.m_startBlock > p_firstBlock) {
+                entry.m_startBlock = qMax(entry.m_startBlock + blocksDelta, p_firstBlock);
+            }
+
+            if (entry.m_endBlock > p_firstBlock) {
+                entry.m_endBlock = qMax(entry.m_endBlock + blocksDelta, p_firstBlock);
             }
         }
-        index = regExp.indexIn(p_text, index + length);
     }
 }
 
-void HGMarkdownHighlighter::parse()
+void HGMarkdownHighlighter::handleParseFinished(int p_timeStamp)
 {
-    if (!parsing.testAndSetRelaxed(0, 1)) {
+    if (p_timeStamp != m_timeStamp) {
         return;
     }
 
-    int nrBlocks = document->blockCount();
-    parseInternal();
+    HGParseResult res;
+    if (!m_parser->takeResult(res) || res.m_timeStamp != m_timeStamp) {
+        return;
+    }
 
-    if (highlightingStyles.isEmpty()) {
-        qWarning() << "HighlightingStyles is not set";
+    QVector<int> changedBlocks;
+    if (!spliceParseResult(res, changedBlocks)) {
+        qWarning() << "highlighter: parse result of blocks" << res.m_startBlock
+                   << res.m_numOfBlocks << res.m_numOfTailBlocks
+                   << "does not match the document, re-parse the whole document";
+        parse(true);
         return;
     }
 
-    initBlockHighlightFromResult(nrBlocks);
+    m_dirtyStartBlock = -1;
+    m_dirtyTailBlocks = 0;
 
-    initHtmlCommentRegionsFromResult();
+    updateCodeBlocks();
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
-    }
+    rehighlightBlocks(changedBlocks);
 
-    parsing.store(0);
+    highlightChanged();
 }
 
-void HGMarkdownHighlighter::parseInternal()
+bool HGMarkdownHighlighter::spliceParseResult(const HGParseResult &p_result,
+                                              QVector<int> &p_changedBlocks)
 {
-    QString text = document->toPlainText();
-    QByteArray ba = text.toUtf8();
-    const char *data = (const char *)ba.data();
-   int len = ba.size();
+    int nrBlocks = document->blockCount();
+    if (p_result.m_startBlock + p_result.m_numOfBlocks + p_result.m_numOfTailBlocks
+        != nrBlocks) {
+        return false;
+    }
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
+    bool full = p_result.m_startBlock == 0 && p_result.m_numOfTailBlocks == 0;
+    if (full) {
+        blockHighlights.resize(nrBlocks);
+        m_blocksFlags.resize(nrBlocks);
+    } else if (blockHighlights.size() != nrBlocks || m_blocksFlags.size() != nrBlocks) {
+        return false;
     }
 
-    if (len == 0) {
-        return;
-    } else if (len >= capacity) {
-        resizeBuffer(qMax(2 * capacity, len * 2));
-    } else if (len < (capacity >> 2)) {
-        resizeBuffer(qMax(capacity >> 1, len * 2));
+    // Comment regions.
+    QTextBlock block = document->findBlockByNumber(p_result.m_startBlock);
+    int startPos = block.position();
+    int endPos = p_result.m_numOfTailBlocks > 0
+                 ? document->findBlockByNumber(nrBlocks - p_result.m_numOfTailBlocks).position()
+                 : document->characterCount();
+
+    // Keep the regions sorted: regions before the snapshot, regions of the
+    // snapshot, and then regions after the snapshot.
+    QVector<VCommentRegion> regions;
+    regions.reserve(p_result.m_commentRegions.size() + (full ? 0 : m_commentRegions.size()));
+    if (!full) {
+        for (auto const &reg : m_commentRegions) {
+            if (reg.m_endPos < startPos) {
+                regions.append(reg);
+            }
+        }
+    }
+
+    for (auto const &reg : p_result.m_commentRegions) {
+        regions.append(VCommentRegion(reg.m_startPos + startPos, reg.m_endPos + startPos));
+    }
+
+    if (!full) {
+        for (auto const &reg : m_commentRegions) {
+            if (reg.m_startPos >= endPos) {
+                regions.append(reg);
+            }
+        }
+    }
+
+    m_commentRegions = regions;
+
+    // It is a superset of current format table.
+    m_formats = p_result.m_formats;
+
+    // Highlights of blocks.
+    // Current highlights of blocks are what have been used to highlight them.
+    for (int i = 0; i < p_result.m_numOfBlocks && block.isValid(); ++i) {
+        int blockNum = p_result.m_startBlock + i;
+        const QVector<HLFormatRun> &runs = p_result.m_blocksHighlights[i];
+        bool inComment = isBlockInsideCommentRegion(block);
+        if (runs != blockHighlights[blockNum]
+            || inComment != (block.userState() == HighlightBlockState::Comment)) {
+            blockHighlights[blockNum] = runs;
+            p_changedBlocks.append(blockNum);
+        }
+
+        m_blocksFlags[blockNum] = p_result.m_blocksFlags[i];
+        block = block.next();
     }
 
-    memcpy(content, data, len);
-    content[len] = '\0';
+    return true;
+}
 
-    pmh_markdown_to_elements(content, pmh_EXT_NONE, &result);
+void HGMarkdownHighlighter::setVisibleBlockRange(int p_first, int p_last)
+{
+    m_firstVisibleBlock = p_first;
+    m_lastVisibleBlock = p_last;
 }
 
-void HGMarkdownHighlighter::handleContentChange(int /* position */, int charsRemoved, int charsAdded)
+void HGMarkdownHighlighter::rehighlightBlocks(const QVector<int> &p_blocks)
 {
-    if (charsRemoved == 0 && charsAdded == 0) {
+    if (p_blocks.isEmpty()) {
         return;
     }
-    timer->stop();
-    timer->start();
+
+    // Merge @p_blocks into m_blocksToRehighlight.
+    QVector<int> blocks(m_blocksToRehighlight.size() + p_blocks.size());
+    auto end = std::merge(m_blocksToRehighlight.begin(), m_blocksToRehighlight.end(),
+                          p_blocks.begin(), p_blocks.end(),
+                          blocks.begin());
+    end = std::unique(blocks.begin(), end);
+    blocks.erase(end, blocks.end());
+    m_blocksToRehighlight = blocks;
+
+    // Blocks in the viewport first.
+    rehighlightBlocksNow(takeBlocksToRehighlight(m_firstVisibleBlock, m_lastVisibleBlock));
+
+    if (!m_blocksToRehighlight.isEmpty()) {
+        m_rehighlightTimer->start();
+    }
 }
 
-void HGMarkdownHighlighter::timerTimeout()
+QVector<int> HGMarkdownHighlighter::takeBlocksToRehighlight(int p_first, int p_last)
 {
-    parse();
-    if (!updateCodeBlocks()) {
-        rehighlight();
+    QVector<int> blocks;
+    if (p_first > p_last) {
+        return blocks;
     }
 
-    highlightChanged();
+    auto first = std::lower_bound(m_blocksToRehighlight.begin(),
+                                  m_blocksToRehighlight.end(),
+                                  p_first);
+    auto last = std::upper_bound(first, m_blocksToRehighlight.end(), p_last);
+    int idx = first - m_blocksToRehighlight.begin();
+    int num = last - first;
+
+    blocks = m_blocksToRehighlight.mid(idx, num);
+    m_blocksToRehighlight.remove(idx, num);
+    return blocks;
+}
+
+void HGMarkdownHighlighter::rehighlightPendingBlocks()
+{
+    // Number of blocks to re-highlight in one run.
+    static const int chunkSize = 100;
+
+    // User may scroll during the process.
+    rehighlightBlocksNow(takeBlocksToRehighlight(m_firstVisibleBlock, m_lastVisibleBlock));
+
+    int num = qMin(chunkSize, m_blocksToRehighlight.size());
+    QVector<int> blocks = m_blocksToRehighlight.mid(0, num);
+    m_blocksToRehighlight.remove(0, num);
+    rehighlightBlocksNow(blocks);
+
+    if (m_blocksToRehighlight.isEmpty()) {
+        m_rehighlightTimer->stop();
+    }
+}
+
+void HGMarkdownHighlighter::rehighlightBlocksNow(const QVector<int> &p_blocks)
+{
+    QTextBlock block;
+    int blockNum = -1;
+    for (auto num : p_blocks) {
+        if (num == blockNum) {
+            continue;
+        } else if (block.isValid() && num == blockNum + 1) {
+            block = block.next();
+        } else {
+            block = document->findBlockByNumber(num);
+        }
+
+        blockNum = num;
+        if (!block.isValid()) {
+            break;
+        }
+
+        rehighlightBlock(block);
+    }
 }
 
 void HGMarkdownHighlighter::updateHighlight()
 {
+    // Request to highlight all the code blocks again.
+    m_codeBlockIndexValid = false;
+
     timer->stop();
     timerTimeout();
 }
 
-bool HGMarkdownHighlighter::updateCodeBlocks()
+void HGMarkdownHighlighter::updateCodeBlocks()
 {
+    int nrBlocks = document->blockCount();
+    m_codeBlockTimeStamp = m_timeStamp;
+    m_newCodeBlockHighlights.clear();
+    m_newCodeBlockHighlights.resize(nrBlocks);
+    m_codeBlockHighlights.resize(nrBlocks);
+    m_codeBlockIdsToRecv.clear();
+
     if (!vconfig.getEnableCodeBlockHighlight()) {
-        m_codeBlockHighlights.clear();
-        return false;
+        m_codeBlockIndex.clear();
+        m_codeBlockIndexValid = false;
+        clearCodeBlockHighlightsOutsideIndex();
+        return;
     }
 
-    m_codeBlockHighlights.resize(document->blockCount());
-    for (int i = 0; i < m_codeBlockHighlights.size(); ++i) {
-        m_codeBlockHighlights[i].clear();
-    }
+    QHash<int, VCodeBlock> scannedBlocks;
+    updateCodeBlockIndex(scannedBlocks);
 
+    // Only request to highlight code blocks whose highlights are out of date.
     QList<VCodeBlock> codeBlocks;
+    for (auto &entry : m_codeBlockIndex) {
+        // Only handle complete codeblocks.
+        if (entry.m_endBlock == -1) {
+            continue;
+        }
+
+        // See if it is a code block inside HTML comment.
+        QTextBlock endBlock = document->findBlockByNumber(entry.m_endBlock);
+        bool inComment = isBlockInsideCommentRegion(endBlock);
+        if (inComment != entry.m_inComment) {
+            entry.m_inComment = inComment;
+            entry.m_highlighted = false;
+        }
+
+        if (entry.m_inComment || entry.m_highlighted) {
+            continue;
+        }
+
+        auto it = scannedBlocks.find(entry.m_id);
+        if (it != scannedBlocks.end()) {
+            codeBlocks.append(it.value());
+        } else {
+            codeBlocks.append(codeBlockOfEntry(entry));
+        }
+
+        codeBlocks.last().m_id = entry.m_id;
+        m_codeBlockIdsToRecv.insert(entry.m_id);
+    }
+
+    clearCodeBlockHighlightsOutsideIndex();
+
+    if (!codeBlocks.isEmpty()) {
+        emit codeBlocksUpdated(codeBlocks);
+    }
+}
+
+void HGMarkdownHighlighter::updateCodeBlockIndex(QHash<int, VCodeBlock> &p_scannedBlocks)
+{
+    int nrBlocks = document->blockCount();
+    int firstBlock = 0;
+    int lastBlock = nrBlocks - 1;
+    if (m_codeBlockIndexValid) {
+        if (m_codeBlocksDirtyStart == -1) {
+            return;
+        }
+
+        firstBlock = qMin(m_codeBlocksDirtyStart, nrBlocks - 1);
+        lastBlock = qMax(nrBlocks - 1 - m_codeBlocksDirtyTail, firstBlock);
+    } else {
+        m_codeBlockIndex.clear();
+    }
+
+    m_codeBlockIndexValid = true;
+    m_codeBlocksDirtyStart = -1;
+    m_codeBlocksDirtyTail = 0;
+
+    // Re-scan from the code block containing @firstBlock, if there is one.
+    int nrEntries = m_codeBlockIndex.size();
+    int firstEntry = 0;
+    while (firstEntry < nrEntries
+           && m_codeBlockIndex[firstEntry].m_endBlock != -1
+           && m_codeBlockIndex[firstEntry].m_endBlock < firstBlock) {
+        ++firstEntry;
+    }
+
+    int blockNum = firstBlock;
+    if (firstEntry < nrEntries) {
+        blockNum = qMin(blockNum, m_codeBlockIndex[firstEntry].m_startBlock);
+    }
 
+    // Old entries within [firstEntry, lastEntry) will be replaced.
+    int lastEntry = firstEntry;
+    QVector<CodeBlockEntry> entries;
+    QVector<VCodeBlock> items;
     VCodeBlock item;
     bool inBlock = false;
+    HGBlockScanResult scan;
+    QTextBlock block = document->findBlockByNumber(blockNum);
+    for (; block.isValid(); block = block.next(), ++blockNum) {
+        if (blockNum > lastBlock && !inBlock) {
+            while (lastEntry < nrEntries
+                   && m_codeBlockIndex[lastEntry].m_endBlock != -1
+                   && m_codeBlockIndex[lastEntry].m_endBlock < blockNum) {
+                ++lastEntry;
+            }
+
+            // Both the old and new index are outside code blocks here and
+            // the following blocks are not changed.
+            if (lastEntry == nrEntries
+                || m_codeBlockIndex[lastEntry].m_startBlock >= blockNum) {
+                break;
+            }
+        }
 
-    // Only handle complete codeblocks.
-    QTextBlock block = document->firstBlock();
-    while (block.isValid()) {
         QString text = block.text();
+        HGMarkdownScanner::scanBlock(text, inBlock, false, scan);
         if (inBlock) {
-            item.m_text = item.m_text + "\n" + text;
-            int idx = codeBlockEndExp.indexIn(text);
-            if (idx >= 0) {
+            item.m_text.append('\n');
+            item.m_text.append(text);
+            if (scan.m_fence == HGBlockScanResult::FenceEnd) {
                 // End block.
                 inBlock = false;
-                item.m_endBlock = block.blockNumber();
+                item.m_endBlock = blockNum;
+                items.append(item);
+            }
+        } else if (scan.m_fence == HGBlockScanResult::FenceStart) {
+            // Start block.
+            inBlock = true;
+            item.m_startBlock = blockNum;
+            item.m_startPos = block.position();
+            item.m_text = text;
+            item.m_lang = text.mid(scan.m_langStart, scan.m_langLength);
+        }
+    }
 
-                // See if it is a code block inside HTML comment.
-                if (!isBlockInsideCommentRegion(block)) {
-                    codeBlocks.append(item);
-                }
+    if (!block.isValid()) {
+        lastEntry = nrEntries;
+    }
+
+    // Keep the id and highlights of code blocks not changed.
+    int oldIdx = firstEntry;
+    for (auto const &it : items) {
+        CodeBlockEntry entry;
+        entry.m_startBlock = it.m_startBlock;
+        entry.m_endBlock = it.m_endBlock;
+        entry.m_hash = qHash(it.m_text);
+        entry.m_inComment = false;
+        entry.m_highlighted = false;
+
+        while (oldIdx < lastEntry
+               && m_codeBlockIndex[oldIdx].m_startBlock < entry.m_startBlock) {
+            ++oldIdx;
+        }
+
+        if (oldIdx < lastEntry) {
+            const CodeBlockEntry &oldEntry = m_codeBlockIndex[oldIdx];
+            if (oldEntry.m_startBlock == entry.m_startBlock
+                && oldEntry.m_endBlock == entry.m_endBlock
+                && oldEntry.m_hash == entry.m_hash) {
+                entry = oldEntry;
             }
+        }
+
+        if (entry.m_highlighted) {
+            Q_ASSERT(entry.m_id >= 0);
         } else {
-            int idx = codeBlockStartExp.indexIn(text);
-            if (idx >= 0) {
-                // Start block.
-                inBlock = true;
-                item.m_startBlock = block.blockNumber();
-                item.m_startPos = block.position();
-                item.m_text = text;
-                if (codeBlockStartExp.captureCount() == 1) {
-                    item.m_lang = codeBlockStartExp.capturedTexts()[1];
-                }
+            if (entry.m_id < 0) {
+                entry.m_id = m_nextCodeBlockId++;
             }
+
+            p_scannedBlocks.insert(entry.m_id, it);
         }
+
+        entries.append(entry);
+    }
+
+    // A code block not closed till the end.
+    if (inBlock) {
+        CodeBlockEntry entry;
+        entry.m_id = m_nextCodeBlockId++;
+        entry.m_startBlock = item.m_startBlock;
+        entry.m_endBlock = -1;
+        entry.m_hash = 0;
+        entry.m_inComment = false;
+        entry.m_highlighted = false;
+        entries.append(entry);
+    }
+
+    m_codeBlockIndex.remove(firstEntry, lastEntry - firstEntry);
+    for (int i = 0; i < entries.size(); ++i) {
+        m_codeBlockIndex.insert(firstEntry + i, entries[i]);
+    }
+}
+
+VCodeBlock HGMarkdownHighlighter::codeBlockOfEntry(const CodeBlockEntry &p_entry) const
+{
+    Q_ASSERT(p_entry.m_endBlock != -1);
+    VCodeBlock item;
+    QTextBlock block = document->findBlockByNumber(p_entry.m_startBlock);
+    item.m_startBlock = p_entry.m_startBlock;
+    item.m_endBlock = p_entry.m_endBlock;
+    item.m_startPos = block.position();
+
+    HGBlockScanResult scan;
+    item.m_text = block.text();
+    HGMarkdownScanner::scanBlock(item.m_text, false, false, scan);
+    item.m_lang = item.m_text.mid(scan.m_langStart, scan.m_langLength);
+
+    for (int i = p_entry.m_startBlock + 1; i <= p_entry.m_endBlock; ++i) {
         block = block.next();
+        item.m_text.append('\n');
+        item.m_text.append(block.text());
     }
 
-    m_numOfCodeBlockHighlightsToRecv = codeBlocks.size();
-    if (m_numOfCodeBlockHighlightsToRecv > 0) {
-        emit codeBlocksUpdated(codeBlocks);
-        return true;
-    } else {
-        return false;
+    return item;
+}
+
+void HGMarkdownHighlighter::clearCodeBlockHighlightsOutsideIndex()
+{
+    QVector<int> changedBlocks;
+    int nrBlocks = m_codeBlockHighlights.size();
+    int blockNum = 0;
+    for (auto const &entry : m_codeBlockIndex) {
+        if (entry.m_endBlock == -1 || entry.m_inComment) {
+            continue;
+        }
+
+        for (; blockNum < entry.m_startBlock && blockNum < nrBlocks; ++blockNum) {
+            if (!m_codeBlockHighlights[blockNum].isEmpty()) {
+                m_codeBlockHighlights[blockNum].clear();
+                changedBlocks.append(blockNum);
+            }
+        }
+
+        blockNum = entry.m_endBlock + 1;
     }
+
+    for (; blockNum < nrBlocks; ++blockNum) {
+        if (!m_codeBlockHighlights[blockNum].isEmpty()) {
+            m_codeBlockHighlights[blockNum].clear();
+            changedBlocks.append(blockNum);
+        }
+    }
+
+    rehighlightBlocks(changedBlocks);
 }
 
 static bool HLUnitStyleComp(const HLUnitStyle &a, const HLUnitStyle &b)
@@ -423,29 +849,35 @@ static bool HLUnitStyleComp(const HLUnitStyle &a, const HLUnitStyle &b)
     }
 }
 
-void HGMarkdownHighlighter::setCodeBlockHighlights(const QList<HLUnitPos> &p_units)
+void HGMarkdownHighlighter::setCodeBlockHighlights(const QList<HLUnitPos> &p_units,
+                                                   const QVector<int> &p_codeBlockIds)
 {
+    // Text has been changed since the code blocks are fetched.
+    if (m_codeBlockTimeStamp != m_timeStamp) {
+        return;
+    }
+
     if (p_units.isEmpty()) {
         goto exit;
     }
 
     {
-    QVector<QVector<HLUnitStyle>> highlights(m_codeBlockHighlights.size());
+    QVector<QVector<HLUnitStyle>> highlights(m_newCodeBlockHighlights.size());
 
     for (auto const &unit : p_units) {
         int pos = unit.m_position;
         int end = unit.m_position + unit.m_length;
-        int startBlockNum = document->findBlock(pos).blockNumber();
-        int endBlockNum = document->findBlock(end).blockNumber();
+        QTextBlock block = document->findBlock(pos);
+        int startBlockNum = block.blockNumber();
+        int endBlockNum = end == pos ? startBlockNum : document->findBlock(end).blockNumber();
 
         // Text has been changed. Abandon the obsolete parsed result.
         if (startBlockNum == -1 || endBlockNum >= highlights.size()) {
             goto exit;
         }
 
-        for (int i = startBlockNum; i <= endBlockNum; ++i)
+        for (int i = startBlockNum; i <= endBlockNum; ++i, block = block.next())
         {
-            QTextBlock block = document->findBlockByNumber(i);
             int blockStartPos = block.position();
             HLUnitStyle hl;
             hl.style = unit.m_style;
@@ -470,16 +902,166 @@ void HGMarkdownHighlighter::setCodeBlockHighlights(const QList<HLUnitPos> &p_uni
         QVector<HLUnitStyle> &units = highlights[i];
         if (!units.isEmpty()) {
             std::sort(units.begin(), units.end(), HLUnitStyleComp);
-            m_codeBlockHighlights[i].append(units);
+            m_newCodeBlockHighlights[i].append(units);
         }
     }
     }
 
 exit:
-    --m_numOfCodeBlockHighlightsToRecv;
-    if (m_numOfCodeBlockHighlightsToRecv <= 0) {
-        rehighlight();
+    commitCodeBlockHighlights(p_codeBlockIds);
+}
+
+void HGMarkdownHighlighter::commitCodeBlockHighlights(const QVector<int> &p_codeBlockIds)
+{
+    int nrBlocks = document->blockCount();
+    if (m_newCodeBlockHighlights.size() != nrBlocks) {
+        return;
+    }
+
+    QSet<int> ids;
+    for (auto id : p_codeBlockIds) {
+        if (m_codeBlockIdsToRecv.remove(id)) {
+            ids.insert(id);
+        }
+    }
+
+    if (ids.isEmpty()) {
+        return;
+    }
+
+    m_codeBlockHighlights.resize(nrBlocks);
+
+    // Only blocks of the code blocks received are updated.
+    QVector<int> changedBlocks;
+    QVector<HLFormatRun> runs;
+    for (auto &entry : m_codeBlockIndex) {
+        if (!ids.contains(entry.m_id)) {
+            continue;
+        }
+
+        Q_ASSERT(entry.m_endBlock != -1 && entry.m_endBlock < nrBlocks);
+        for (int i = entry.m_startBlock; i <= entry.m_endBlock; ++i) {
+            runs.clear();
+            codeBlockUnitsToRuns(m_newCodeBlockHighlights[i], runs);
+            m_newCodeBlockHighlights[i].clear();
+            if (runs != m_codeBlockHighlights[i]) {
+                m_codeBlockHighlights[i] = runs;
+                changedBlocks.append(i);
+            }
+        }
+
+        entry.m_highlighted = true;
+    }
+
+    if (m_codeBlockIdsToRecv.isEmpty()) {
+        m_newCodeBlockHighlights.clear();
+    }
+
+    rehighlightBlocks(changedBlocks);
+}
+
+void HGMarkdownHighlighter::codeBlockUnitsToRuns(const QVector<HLUnitStyle> &p_units,
+                                                 QVector<HLFormatRun> &p_runs)
+{
+    m_codeBlockBounds.clear();
+    for (int i = 0; i < p_units.size(); ++i) {
+        const HLUnitStyle &unit = p_units[i];
+        if (unit.length == 0) {
+            continue;
+        }
+
+        auto it = m_codeBlockStyleIds.find(unit.style);
+        if (it == m_codeBlockStyleIds.end()) {
+            continue;
+        }
+
+        CodeBlockUnitBound bound;
+        bound.m_styleId = it.value();
+        bound.m_order = i;
+        bound.m_pos = unit.start;
+        bound.m_delta = 1;
+        m_codeBlockBounds.append(bound);
+
+        bound.m_pos = unit.start + unit.length;
+        bound.m_delta = -1;
+        m_codeBlockBounds.append(bound);
+    }
+
+    std::sort(m_codeBlockBounds.begin(), m_codeBlockBounds.end());
+
+    // Number of units of each style covering current position, and the order
+    // of the outermost one of them.
+    int counts[c_maxNumOfCodeBlockStyles] = { 0 };
+    int orders[c_maxNumOfCodeBlockStyles] = { 0 };
+    quint64 mask = 0;
+    int nrBounds = m_codeBlockBounds.size();
+    int i = 0;
+    while (i < nrBounds) {
+        unsigned long pos = m_codeBlockBounds[i].m_pos;
+        for (; i < nrBounds && m_codeBlockBounds[i].m_pos == pos; ++i) {
+            const CodeBlockUnitBound &bound = m_codeBlockBounds[i];
+            int &cnt = counts[bound.m_styleId];
+            cnt += bound.m_delta;
+            if (cnt > 0) {
+                if (cnt == 1 && bound.m_delta == 1) {
+                    orders[bound.m_styleId] = bound.m_order;
+                }
+
+                mask |= (quint64)1 << bound.m_styleId;
+            } else {
+                mask &= ~((quint64)1 << bound.m_styleId);
+            }
+        }
+
+        if (i == nrBounds || mask == 0) {
+            continue;
+        }
+
+        int idx = codeBlockFormatIndex(mask, orders);
+        int length = m_codeBlockBounds[i].m_pos - pos;
+        if (!p_runs.isEmpty()) {
+            HLFormatRun &last = p_runs.last();
+            if (last.m_formatIndex == idx
+                && last.m_start + last.m_length == (int)pos) {
+                last.m_length += length;
+                continue;
+            }
+        }
+
+        p_runs.append(HLFormatRun(pos, length, idx));
+    }
+}
+
+int HGMarkdownHighlighter::codeBlockFormatIndex(quint64 p_mask, const int *p_orders)
+{
+    auto it = m_codeBlockFormatIndexes.find(p_mask);
+    if (it != m_codeBlockFormatIndexes.end()) {
+        return it.value();
+    }
+
+    // Outer units come first so inner units take precedence. A set of styles
+    // is nested the same way in the grammars of highlight.js, so the mask is
+    // enough to identify the merged format.
+    QVector<int> ids;
+    for (int i = 0; i < m_codeBlockStyleFormats.size(); ++i) {
+        if (p_mask & ((quint64)1 << i)) {
+            ids.append(i);
+        }
     }
+
+    std::sort(ids.begin(), ids.end(), [p_orders](int p_a, int p_b) {
+        return p_orders[p_a] < p_orders[p_b];
+    });
+
+    QTextCharFormat format;
+    for (auto id : ids) {
+        format.merge(m_codeBlockStyleFormats[id]);
+    }
+
+    m_codeBlockFormats.append(format);
+    int idx = m_codeBlockFormats.size() - 1;
+    m_codeBlockFormatIndexes.insert(p_mask, idx);
+    return idx;
 }
 
 bool HGMarkdownHighlighter::isBlockInsideCommentRegion(const QTextBlock &p_block) const
@@ -491,13 +1073,44 @@ bool HGMarkdownHighlighter::isBlockInsideCommentRegion(const QTextBlock &p_block
     int start = p_block.position();
     int end = start + p_block.length();
 
-    for (auto const & reg : m_commentRegions) {
-        if (reg.contains(start) && reg.contains(end)) {
-            return true;
+    // Regions do not overlap, so only the one containing @start could contain
+    // the whole block.
+    int idx = findCommentRegion(start);
+    if (idx == -1) {
+        return false;
+    }
+
+    const VCommentRegion &reg = m_commentRegions[idx];
+    return reg.contains(start) && reg.contains(end);
+}
+
+static bool commentRegionStartLess(int p_pos, const VCommentRegion &p_reg)
+{
+    return p_pos < p_reg.m_startPos;
+}
+
+int HGMarkdownHighlighter::findCommentRegion(int p_pos) const
+{
+    int nrRegions = m_commentRegions.size();
+
+    // Blocks are usually highlighted in order. Try the last found region and
+    // the next one before a binary search.
+    for (int i = qMax(m_commentRegionHint, 0); i < nrRegions && i <= m_commentRegionHint + 1; ++i) {
+        if (m_commentRegions[i].m_startPos <= p_pos
+            && (i == nrRegions - 1 || m_commentRegions[i + 1].m_startPos > p_pos)) {
+            m_commentRegionHint = i;
+            return i;
         }
     }
 
-    return false;
+    auto it = std::upper_bound(m_commentRegions.begin(), m_commentRegions.end(),
+                               p_pos, commentRegionStartLess);
+    int idx = (it - m_commentRegions.begin()) - 1;
+    if (idx >= 0) {
+        m_commentRegionHint = idx;
+    }
+
+    return idx;
 }
 
 void HGMarkdownHighlighter::highlightChanged()
@@ -3,11 +3,12 @@
 
 #include <QTextCharFormat>
 #include <QSyntaxHighlighter>
-#include <QAtomicInt>
 #include <QSet>
 #include <QList>
 #include <QString>
 #include <QHash>
+#include <QVector>
+#include "hgmarkdownscanner.h"
 
 extern "C" {
 #include <pmh_parser.h>
@@ -15,8 +16,12 @@ extern "C" {
 
 QT_BEGIN_NAMESPACE
 class QTextDocument;
+class QThread;
 QT_END_NAMESPACE
 
+class HGMarkdownParser;
+struct HGParseResult;
+
 struct HighlightingStyle
 {
     pmh_element_type type;
@@ -34,6 +39,17 @@ enum HighlightBlockState
     Comment
 };
 
+// Properties of a block fetched from the parse result.
+// Used to find safe boundaries to re-parse part of the document.
+enum HighlightBlockFlag
+{
+    // This block continues a HTML block or HTML comment from previous blocks.
+    ContinuedElement = 0x1,
+
+    // This block is part of a reference definition.
+    ReferenceDefinition = 0x2
+};
+
 // One continuous region for a certain markdown highlight style
 // within a QTextBlock.
 // Pay attention to the change of HighlightingStyles[]
@@ -44,6 +60,40 @@ struct HLUnit
     unsigned long start;
     unsigned long length;
     unsigned int styleIndex;
+
+    bool operator==(const HLUnit &p_a) const
+    {
+        return start == p_a.start
+               && length == p_a.length
+               && styleIndex == p_a.styleIndex;
+    }
+};
+
+// A run of characters within a QTextBlock sharing the same format.
+// Runs of a block are sorted by position and do not overlap.
+struct HLFormatRun
+{
+    HLFormatRun() : m_start(0), m_length(0), m_formatIndex(-1)
+    {
+    }
+
+    HLFormatRun(int p_start, int p_length, int p_formatIndex)
+        : m_start(p_start), m_length(p_length), m_formatIndex(p_formatIndex)
+    {
+    }
+
+    int m_start;
+    int m_length;
+
+    // Index of the format in the format table the run comes with.
+    int m_formatIndex;
+
+    bool operator==(const HLFormatRun &p_a) const
+    {
+        return m_start == p_a.m_start
+               && m_length == p_a.m_length
+               && m_formatIndex == p_a.m_formatIndex;
+    }
 };
 
 struct HLUnitStyle
@@ -51,11 +101,21 @@ struct HLUnitStyle
     unsigned long start;
     unsigned long length;
     QString style;
+
+    bool operator==(const HLUnitStyle &p_a) const
+    {
+        return start == p_a.start
+               && length == p_a.length
+               && style == p_a.style;
+    }
 };
 
 // Fenced code block only.
 struct VCodeBlock
 {
+    // Id of the code block in HGMarkdownHighlighter, to set its highlights.
+    int m_id;
+
     int m_startPos;
     int m_startBlock;
     int m_endBlock;
@@ -111,8 +171,18 @@ public:
                           int waitInterval,
                           QTextDocument *parent = 0);
     ~HGMarkdownHighlighter();
-    // Request to update highlihgt (re-parse and re-highlight)
-    void setCodeBlockHighlights(const QList<HLUnitPos> &p_units);
+    // Set highlights @p_units of code blocks with id in @p_codeBlockIds, of
+    // those emitted by codeBlocksUpdated(). The changed blocks of them will
+    // be re-highlighted, so highlights could be set batch by batch.
+    void setCodeBlockHighlights(const QList<HLUnitPos> &p_units,
+                                const QVector<int> &p_codeBlockIds);
+
+    // Set the range of blocks visible in the editor. These blocks will be
+    // re-highlighted first.
+    void setVisibleBlockRange(int p_first, int p_last);
+
+    int getFirstVisibleBlock() const;
+    int getLastVisibleBlock() const;
 
 signals:
     void highlightCompleted();
@@ -128,63 +198,246 @@ private slots:
     void handleContentChange(int position, int charsRemoved, int charsAdded);
     void timerTimeout();
 
+    // Parser thread has finished parsing the snapshot with @p_timeStamp.
+    void handleParseFinished(int p_timeStamp);
+
+    // Re-highlight a chunk of m_blocksToRehighlight.
+    void rehighlightPendingBlocks();
+
 private:
-    QRegExp codeBlockStartExp;
-    QRegExp codeBlockEndExp;
     QTextCharFormat codeBlockFormat;
     QTextCharFormat m_linkFormat;
     QTextCharFormat m_imageFormat;
 
     QTextDocument *document;
     QVector<HighlightingStyle> highlightingStyles;
-    QHash<QString, QTextCharFormat> m_codeBlockStyles;
-    QVector<QVector<HLUnit> > blockHighlights;
+
+    // Id of each code block style, like "hljs-keyword", indexing into
+    // m_codeBlockStyleFormats. Ids are used as bits of a style mask.
+    QHash<QString, int> m_codeBlockStyleIds;
+    QVector<QTextCharFormat> m_codeBlockStyleFormats;
+    QVector<QVector<HLFormatRun> > blockHighlights;
+
+    // Format table of blockHighlights, which is built by the parser. Formats
+    // are only appended to it so the index of a format never changes.
+    QVector<QTextCharFormat> m_formats;
+
+    // HighlightBlockFlag of each block, indexed by block number.
+    QVector<int> m_blocksFlags;
 
     // Use another member to store the codeblocks highlights, because the highlight
     // sequence is blockHighlights, regular-expression-based highlihgts, and then
     // codeBlockHighlights.
     // Support fenced code block only.
-    QVector<QVector<HLUnitStyle> > m_codeBlockHighlights;
+    QVector<QVector<HLFormatRun> > m_codeBlockHighlights;
+
+    // Format table of m_codeBlockHighlights.
+    QVector<QTextCharFormat> m_codeBlockFormats;
+
+    // Index in m_codeBlockFormats of the merged format of code block styles
+    // in a mask.
+    QHash<quint64, int> m_codeBlockFormatIndexes;
+
+    // Start or end of a code block unit.
+    struct CodeBlockUnitBound
+    {
+        unsigned long m_pos;
+        int m_styleId;
+        // 1 for start and -1 for end.
+        int m_delta;
+        // Index of the unit in its sorted units.
+        int m_order;
+
+        bool operator<(const CodeBlockUnitBound &p_a) const
+        {
+            return m_pos < p_a.m_pos;
+        }
+    };
+
+    // Reused by codeBlockUnitsToRuns().
+    QVector<CodeBlockUnitBound> m_codeBlockBounds;
+
+    // Max number of code block styles a mask could hold.
+    static const int c_maxNumOfCodeBlockStyles = 64;
+
+    // Code block highlights being received. Will replace m_codeBlockHighlights
+    // of a code block once it is received.
+    QVector<QVector<HLUnitStyle> > m_newCodeBlockHighlights;
 
-    int m_numOfCodeBlockHighlightsToRecv;
+    // m_timeStamp when code blocks are fetched.
+    int m_codeBlockTimeStamp;
 
-    // All HTML comment regions.
+    // All HTML comment regions, sorted by position. They do not overlap.
     QVector<VCommentRegion> m_commentRegions;
 
+    // Index of the region found last time by findCommentRegion().
+    mutable int m_commentRegionHint;
+
     // Timer to signal highlightCompleted().
     QTimer *m_completeTimer;
 
-    QAtomicInt parsing;
     QTimer *timer;
     int waitInterval;
 
-    char *content;
-    int capacity;
-    pmh_element **result;
+    // Generation of the document content. Increased on each change of the
+    // content. Parse results of an older generation will be abandoned.
+    int m_timeStamp;
+
+    // Parse the document in m_parserThread.
+    HGMarkdownParser *m_parser;
+    QThread *m_parserThread;
+
+    // Blocks changed since last applied parse result are those starting from
+    // m_dirtyStartBlock, excluding the last m_dirtyTailBlocks blocks.
+    // -1 if no block is dirty.
+    int m_dirtyStartBlock;
+    int m_dirtyTailBlocks;
+
+    // Blocks waiting to be re-highlighted, sorted by block number.
+    QVector<int> m_blocksToRehighlight;
+
+    // Timer to re-highlight m_blocksToRehighlight chunk by chunk.
+    QTimer *m_rehighlightTimer;
+
+    // Blocks visible in the editor.
+    int m_firstVisibleBlock;
+    int m_lastVisibleBlock;
+
+    // A fenced code block in m_codeBlockIndex.
+    struct CodeBlockEntry
+    {
+        CodeBlockEntry() : m_id(-1), m_startBlock(-1), m_endBlock(-1), m_hash(0),
+                           m_inComment(false), m_highlighted(false)
+        {
+        }
+
+        // Kept as long as the text of the code block is not changed.
+        int m_id;
+
+        int m_startBlock;
+
+        // -1 if the code block is not closed, which could only be the last one.
+        int m_endBlock;
+
+        // Hash of the text of the code block.
+        uint m_hash;
+
+        // Whether it is inside a HTML comment.
+        bool m_inComment;
+
+        // Whether m_codeBlockHighlights of its blocks are up to date.
+        bool m_highlighted;
+    };
+
+    // Fenced code blocks sorted by position. Only the part touched by the
+    // changes is re-scanned on each update.
+    QVector<CodeBlockEntry> m_codeBlockIndex;
+
+    // Whether m_codeBlockIndex could be updated incrementally.
+    bool m_codeBlockIndexValid;
+
+    int m_nextCodeBlockId;
+
+    // Blocks changed since last update of m_codeBlockIndex, like
+    // m_dirtyStartBlock and m_dirtyTailBlocks.
+    int m_codeBlocksDirtyStart;
+    int m_codeBlocksDirtyTail;
+
+    // Id of code blocks whose highlights are being received.
+    QSet<int> m_codeBlockIdsToRecv;
+
+    // Scan result of the block being highlighted.
+    HGBlockScanResult m_scanResult;
 
-    static const int initCapacity;
+    // Highlight the block according to m_scanResult.
+    // @p_inCodeBlock: whether previous block is inside a fenced code block.
+    void highlightCodeBlock(const QString &text, bool p_inCodeBlock);
+    void highlightLinkWithSpacesInURL();
 
-    void resizeBuffer(int newCap);
-    void highlightCodeBlock(const QString &text);
-    void highlightLinkWithSpacesInURL(const QString &p_text);
-    void parse();
-    void parseInternal();
-    void initBlockHighlightFromResult(int nrBlocks);
-    void initBlockHighlihgtOne(unsigned long pos, unsigned long end,
-                               int styleIndex);
+    // Take a snapshot of the dirty part of the document and request the parser
+    // thread to parse it.
+    // Parse the whole document if @p_full is true.
+    void parse(bool p_full = false);
 
-    // Return true if there are fenced code blocks and it will call rehighlight() later.
-    // Return false if there is none.
-    bool updateCodeBlocks();
+    // Whether it is safe to split the document right before block @p_blockNum.
+    bool isSafeBoundary(const QTextBlock &p_block, int p_blockNum) const;
 
-    // Fetch all the HTML comment regions from parsing result.
-    void initHtmlCommentRegionsFromResult();
+    // Plain text of blocks [@p_first, @p_last].
+    QString textOfBlocks(int p_first, int p_last) const;
+
+    // Text of reference definitions in blocks before @p_first and the last
+    // @p_tailBlocks blocks.
+    QString referencesOutsideBlocks(int p_first, int p_tailBlocks) const;
+
+    // Keep the data of blocks aligned with the blocks after the content change.
+    void adjustBlocksData(int p_position, int p_charsRemoved, int p_charsAdded,
+                          int p_firstBlock);
+
+    // Replace parse result of blocks [@p_result.m_startBlock, -@p_result.m_numOfTailBlocks)
+    // with @p_result. Return false if it does not match current result.
+    // @p_changedBlocks: blocks whose highlights are changed.
+    bool spliceParseResult(const HGParseResult &p_result, QVector<int> &p_changedBlocks);
+
+    // Re-highlight @p_blocks sorted by block number. Blocks visible in the
+    // editor are re-highlighted immediately and others will be re-highlighted
+    // later chunk by chunk.
+    void rehighlightBlocks(const QVector<int> &p_blocks);
+
+    // Remove blocks within [@p_first, @p_last] from m_blocksToRehighlight.
+    QVector<int> takeBlocksToRehighlight(int p_first, int p_last);
+
+    void rehighlightBlocksNow(const QVector<int> &p_blocks);
+
+    // Update the index of fenced code blocks and request to highlight the
+    // complete ones which are added or changed.
+    void updateCodeBlocks();
+
+    // Re-scan the changed part of the document to update m_codeBlockIndex.
+    // @p_scannedBlocks: complete code blocks scanned and not highlighted yet,
+    // keyed by id.
+    void updateCodeBlockIndex(QHash<int, VCodeBlock> &p_scannedBlocks);
+
+    // Fetch the text of the code block of @p_entry.
+    VCodeBlock codeBlockOfEntry(const CodeBlockEntry &p_entry) const;
+
+    // Clear code block highlights of blocks outside the complete code blocks
+    // in m_codeBlockIndex.
+    void clearCodeBlockHighlightsOutsideIndex();
+
+    // Convert possibly overlapping @p_units sorted by HLUnitStyleComp to
+    // disjoint runs.
+    void codeBlockUnitsToRuns(const QVector<HLUnitStyle> &p_units,
+                              QVector<HLFormatRun> &p_runs);
+
+    // Get the index in m_codeBlockFormats of the merged format of styles in
+    // @p_mask. Styles are merged in the order of @p_orders, indexed by style
+    // id, so that inner units take precedence.
+    int codeBlockFormatIndex(quint64 p_mask, const int *p_orders);
+
+    // Replace m_codeBlockHighlights of code blocks with id in both
+    // @p_codeBlockIds and m_codeBlockIdsToRecv with m_newCodeBlockHighlights
+    // and re-highlight the changed blocks.
+    void commitCodeBlockHighlights(const QVector<int> &p_codeBlockIds);
 
     // Whether @p_block is totally inside a HTML comment.
     bool isBlockInsideCommentRegion(const QTextBlock &p_block) const;
 
+    // Find the last region in m_commentRegions starting at or before @p_pos.
+    // Return -1 if there is none.
+    int findCommentRegion(int p_pos) const;
+
     // Highlights have been changed. Try to signal highlightCompleted().
     void highlightChanged();
 };
 
+inline int HGMarkdownHighlighter::getFirstVisibleBlock() const
+{
+    return m_firstVisibleBlock;
+}
+
+inline int HGMarkdownHighlighter::getLastVisibleBlock() const
+{
+    return m_lastVisibleBlock;
+}
+
 #endif
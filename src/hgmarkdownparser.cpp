@@ -0,0 +1,418 @@
+#include "hgmarkdownparser.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <algorithm>
+#include <string.h>
+
+const size_t HGMarkdownParser::c_minWarmTextSize = 1024 * 1024;
+
+const size_t HGMarkdownParser::c_memoSize = 4 * 1024 * 1024;
+
+HGMarkdownParser::HGMarkdownParser(const QVector<HighlightingStyle> &p_styles,
+                                   QObject *p_parent)
+    : QObject(p_parent), m_styles(p_styles), m_hasRequest(false),
+      m_hasResult(false), m_latestTimeStamp(0), m_pmhResult(NULL),
+      m_parsingTimeStamp(0), m_warmTextSize(0), m_numOfUnitsHint(0)
+{
+    m_pmhContext = pmh_context_create();
+    pmh_context_set_memo(m_pmhContext, pmh_MEMO_HTML_BLOCKS | pmh_MEMO_EMPHASIS,
+                         c_memoSize);
+    pmh_context_set_cancel(m_pmhContext, &HGMarkdownParser::isParseCancelled,
+                           this, 0);
+
+    m_parallelParser.setMemo(pmh_MEMO_HTML_BLOCKS | pmh_MEMO_EMPHASIS, c_memoSize);
+    m_parallelParser.setCancel(&HGMarkdownParser::isParseCancelled, this);
+
+    memset(&m_flatElements, 0, sizeof(m_flatElements));
+
+    for (int i = 0; i < m_styles.size(); ++i) {
+        if (i >= c_maxNumOfStyles) {
+            qWarning() << "highlighter: too many styles, skip style" << i;
+            break;
+        }
+
+        int type = m_styles[i].type;
+        if (type >= 0 && type < pmh_NUM_LANG_TYPES) {
+            m_stylesOfType[type].append(i);
+        }
+    }
+
+    // Always handle the request in the thread this object lives in.
+    connect(this, &HGMarkdownParser::parseRequested,
+            this, &HGMarkdownParser::doParse,
+            Qt::QueuedConnection);
+}
+
+HGMarkdownParser::~HGMarkdownParser()
+{
+    m_pmhResult = NULL;
+    pmh_context_destroy(m_pmhContext);
+    m_pmhContext = NULL;
+
+    pmh_free_flat_elements(&m_flatElements);
+}
+
+void HGMarkdownParser::requestParse(const HGParseRequest &p_request)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_request = p_request;
+        m_hasRequest = true;
+    }
+
+    emit parseRequested();
+}
+
+void HGMarkdownParser::invalidate(int p_timeStamp)
+{
+    m_latestTimeStamp.store(p_timeStamp);
+}
+
+bool HGMarkdownParser::takeResult(HGParseResult &p_result)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_hasResult) {
+        return false;
+    }
+
+    p_result = m_result;
+    m_result = HGParseResult();
+    m_hasResult = false;
+    return true;
+}
+
+bool HGMarkdownParser::isObsolete(int p_timeStamp) const
+{
+    return p_timeStamp != m_latestTimeStamp.load();
+}
+
+int HGMarkdownParser::isParseCancelled(void *p_parser)
+{
+    const HGMarkdownParser *parser = static_cast<const HGMarkdownParser *>(p_parser);
+    return parser->isObsolete(parser->m_parsingTimeStamp);
+}
+
+void HGMarkdownParser::doParse()
+{
+    HGParseRequest req;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_hasRequest) {
+            // Already handled by a previous call.
+            return;
+        }
+
+        req = m_request;
+        m_request = HGParseRequest();
+        m_hasRequest = false;
+    }
+
+    if (isObsolete(req.m_timeStamp)) {
+        return;
+    }
+
+    HGParseResult res;
+    res.m_timeStamp = req.m_timeStamp;
+    res.m_startBlock = req.m_startBlock;
+    res.m_numOfTailBlocks = req.m_numOfTailBlocks;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Parse the UTF-16 text as is, so the offsets of the elements are in the
+    // same units as the positions of QTextDocument.
+    QString text = req.m_text;
+    if (!req.m_references.isEmpty()) {
+        // Elements from the references will be dropped since they locate
+        // beyond the last block.
+        text.append("\n\n");
+        text.append(req.m_references);
+    }
+
+    m_parsingTimeStamp = req.m_timeStamp;
+    if (!parseText(text)) {
+        // The text has been changed during parsing.
+        return;
+    }
+
+    res.m_parseTime = timer.nsecsElapsed() / 1000;
+    timer.restart();
+
+    if (!isObsolete(req.m_timeStamp)) {
+        if (m_styles.isEmpty()) {
+            qWarning() << "HighlightingStyles is not set";
+        }
+
+        initBlockStarts(req.m_text);
+
+        initBlockHighlightFromResult(res);
+    }
+
+    res.m_mapTime = timer.nsecsElapsed() / 1000;
+
+    // The elements are kept by m_pmhContext or m_parallelParser until next
+    // parse.
+    m_pmhResult = NULL;
+
+    // The text has been changed during parsing.
+    if (isObsolete(req.m_timeStamp)) {
+        return;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_result = res;
+        m_hasResult = true;
+    }
+
+    emit parseFinished(res.m_timeStamp);
+}
+
+bool HGMarkdownParser::parseText(const QString &p_text)
+{
+    m_pmhResult = NULL;
+
+    size_t len = p_text.size();
+    if (len == 0) {
+        return true;
+    }
+
+    // Release the memory of the context if it is much larger than needed.
+    if (m_warmTextSize > c_minWarmTextSize
+        && len < (m_warmTextSize >> 2)) {
+        pmh_context_reset(m_pmhContext);
+        m_parallelParser.reset();
+        m_warmTextSize = 0;
+    }
+
+    if (len > m_warmTextSize) {
+        m_warmTextSize = len;
+    }
+
+    int maxChunks = HGParallelParser::maxNumOfChunks(len);
+    if (maxChunks > 1) {
+        return m_parallelParser.parse(p_text, maxChunks, &m_pmhResult);
+    }
+
+    return pmh_context_parse_utf16(m_pmhContext, p_text.utf16(), len,
+                                   pmh_EXT_NONE, &m_pmhResult) == pmh_PARSE_DONE;
+}
+
+void HGMarkdownParser::initBlockStarts(const QString &p_text)
+{
+    // QTextDocument::toPlainText() separates blocks with '\n'.
+    m_blockStarts.clear();
+    m_blockStarts.append(0);
+    for (int i = 0; i < p_text.size(); ++i) {
+        if (p_text[i] == QChar('\n')) {
+            m_blockStarts.append(i + 1);
+        }
+    }
+
+    // Length of the last block contains the implicit paragraph separator.
+    m_blockStarts.append(p_text.size() + 1);
+}
+
+void HGMarkdownParser::initBlockHighlightFromResult(HGParseResult &p_result)
+{
+    p_result.m_numOfBlocks = m_blockStarts.size() - 1;
+    p_result.m_blocksHighlights.resize(p_result.m_numOfBlocks);
+    p_result.m_blocksFlags.fill(0, p_result.m_numOfBlocks);
+    p_result.m_commentRegions.clear();
+
+    pmh_flatten_elements(m_pmhResult, &m_flatElements);
+    mapElementsToBlocks(p_result);
+
+    p_result.m_formats = m_formats;
+}
+
+void HGMarkdownParser::mapElementsToBlocks(HGParseResult &p_result)
+{
+    int nrBlocks = m_blockStarts.size() - 1;
+    unsigned long textEnd = m_blockStarts[nrBlocks];
+    QVector<int> &flags = p_result.m_blocksFlags;
+
+    // Sweep the elements sorted by position with a block cursor moving
+    // forward only.
+    QVector<BlockUnit> units;
+    units.reserve(m_numOfUnitsHint);
+    QVector<int> unitsPerBlock(nrBlocks, 0);
+    int blockNum = 0;
+    const pmh_flat_elements &elems = m_flatElements;
+    for (size_t j = 0; j < elems.len; ++j) {
+        // pos and end is the start and end position of the element in
+        // document. Elements beyond the last block come from the references.
+        unsigned long pos = elems.pos[j];
+        unsigned long end = elems.end[j];
+        if (pos >= textEnd) {
+            break;
+        }
+
+        // HTML blocks and comments continue in the blocks after the first one.
+        int type = elems.types[j];
+        int flag = 0;
+        bool flagFirstBlock = false;
+        if (type == pmh_HTMLBLOCK || type == pmh_COMMENT) {
+            flag = HighlightBlockFlag::ContinuedElement;
+        } else if (type == pmh_REFERENCE) {
+            flag = HighlightBlockFlag::ReferenceDefinition;
+            flagFirstBlock = true;
+        }
+
+        if (type == pmh_COMMENT) {
+            p_result.m_commentRegions.push_back(VCommentRegion(pos, end));
+        }
+
+        const QVector<int> &styles = m_stylesOfType[type];
+        if (styles.isEmpty() && flag == 0) {
+            continue;
+        }
+
+        while (m_blockStarts[blockNum + 1] <= pos) {
+            ++blockNum;
+        }
+
+        for (int i = blockNum; i < nrBlocks; ++i) {
+            unsigned long blockStartPos = m_blockStarts[i];
+            unsigned long blockLength = m_blockStarts[i + 1] - blockStartPos;
+            bool isEndBlock = i == nrBlocks - 1 || m_blockStarts[i + 1] > end;
+
+            if (flag != 0
+                && (i == blockNum ? flagFirstBlock : blockStartPos < end)) {
+                flags[i] |= flag;
+            }
+
+            BlockUnit bu;
+            bu.m_blockNum = i;
+            HLUnit &unit = bu.m_unit;
+            if (i == blockNum) {
+                unit.start = pos - blockStartPos;
+                unit.length = isEndBlock ? (end - pos) : (blockLength - unit.start);
+            } else if (isEndBlock) {
+                unit.start = 0;
+                unit.length = end - blockStartPos;
+            } else {
+                unit.start = 0;
+                unit.length = blockLength;
+            }
+
+            for (auto styleIndex : styles) {
+                unit.styleIndex = styleIndex;
+                units.append(bu);
+                ++unitsPerBlock[i];
+            }
+
+            if (isEndBlock) {
+                break;
+            }
+        }
+    }
+
+    qDebug() << "highlighter:" << p_result.m_commentRegions.size() << "HTML comment regions";
+
+    m_numOfUnitsHint = units.size();
+
+    // Group the units by block.
+    QVector<int> offsets(nrBlocks + 1, 0);
+    for (int i = 0; i < nrBlocks; ++i) {
+        offsets[i + 1] = offsets[i] + unitsPerBlock[i];
+    }
+
+    QVector<HLUnit> groupedUnits(units.size());
+    for (auto const &bu : units) {
+        int &num = unitsPerBlock[bu.m_blockNum];
+        --num;
+        groupedUnits[offsets[bu.m_blockNum] + num] = bu.m_unit;
+    }
+
+    QVector<QVector<HLFormatRun> > &highlights = p_result.m_blocksHighlights;
+    for (int i = 0; i < nrBlocks; ++i) {
+        int nrUnits = offsets[i + 1] - offsets[i];
+        if (nrUnits > 0) {
+            unitsToRuns(groupedUnits.constData() + offsets[i], nrUnits, highlights[i]);
+        }
+    }
+}
+
+void HGMarkdownParser::unitsToRuns(const HLUnit *p_units, int p_nrUnits,
+                                   QVector<HLFormatRun> &p_runs)
+{
+    m_bounds.clear();
+    for (int i = 0; i < p_nrUnits; ++i) {
+        const HLUnit &unit = p_units[i];
+        if (unit.length == 0) {
+            continue;
+        }
+
+        UnitBound bound;
+        bound.m_styleIndex = unit.styleIndex;
+        bound.m_pos = unit.start;
+        bound.m_delta = 1;
+        m_bounds.append(bound);
+
+        bound.m_pos = unit.start + unit.length;
+        bound.m_delta = -1;
+        m_bounds.append(bound);
+    }
+
+    std::sort(m_bounds.begin(), m_bounds.end());
+
+    // Number of units of each style covering current position.
+    int counts[c_maxNumOfStyles] = { 0 };
+    quint64 mask = 0;
+    int nrBounds = m_bounds.size();
+    int i = 0;
+    while (i < nrBounds) {
+        unsigned long pos = m_bounds[i].m_pos;
+        for (; i < nrBounds && m_bounds[i].m_pos == pos; ++i) {
+            const UnitBound &bound = m_bounds[i];
+            int &cnt = counts[bound.m_styleIndex];
+            cnt += bound.m_delta;
+            if (cnt > 0) {
+                mask |= (quint64)1 << bound.m_styleIndex;
+            } else {
+                mask &= ~((quint64)1 << bound.m_styleIndex);
+            }
+        }
+
+        if (i == nrBounds || mask == 0) {
+            continue;
+        }
+
+        int idx = formatIndex(mask);
+        int length = m_bounds[i].m_pos - pos;
+        if (!p_runs.isEmpty()) {
+            HLFormatRun &last = p_runs.last();
+            if (last.m_formatIndex == idx
+                && last.m_start + last.m_length == (int)pos) {
+                last.m_length += length;
+                continue;
+            }
+        }
+
+        p_runs.append(HLFormatRun(pos, length, idx));
+    }
+}
+
+int HGMarkdownParser::formatIndex(quint64 p_mask)
+{
+    auto it = m_formatIndexes.find(p_mask);
+    if (it != m_formatIndexes.end()) {
+        return it.value();
+    }
+
+    // Latter style takes precedence over former one.
+    QTextCharFormat format;
+    for (int i = 0; i < m_styles.size() && i < c_maxNumOfStyles; ++i) {
+        if (p_mask & ((quint64)1 << i)) {
+            format.merge(m_styles[i].format);
+        }
+    }
+
+    m_formats.append(format);
+    int idx = m_formats.size() - 1;
+    m_formatIndexes.insert(p_mask, idx);
+    return idx;
+}
@@ -0,0 +1,215 @@
+#ifndef HGMARKDOWNPARSER_H
+#define HGMARKDOWNPARSER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QVector>
+#include <QString>
+#include <QHash>
+#include "hgmarkdownhighlighter.h"
+#include "hgparallelparser.h"
+
+// A snapshot of the document to be parsed in the parser thread.
+struct HGParseRequest
+{
+    HGParseRequest() : m_timeStamp(0), m_startBlock(0), m_numOfTailBlocks(0)
+    {
+    }
+
+    // Generation of the document when the snapshot is taken.
+    int m_timeStamp;
+
+    // The snapshot covers blocks starting from m_startBlock, excluding the
+    // last m_numOfTailBlocks blocks of the document.
+    int m_startBlock;
+    int m_numOfTailBlocks;
+
+    // Plain text of the blocks to parse.
+    QString m_text;
+
+    // Reference definitions outside the snapshot, which are parsed along with
+    // m_text so that reference links within m_text could be resolved.
+    QString m_references;
+};
+
+// Parse result which has been mapped to blocks.
+struct HGParseResult
+{
+    HGParseResult() : m_timeStamp(0), m_startBlock(0), m_numOfBlocks(0),
+                      m_numOfTailBlocks(0), m_parseTime(0), m_mapTime(0)
+    {
+    }
+
+    // Generation of the HGParseRequest this result comes from.
+    int m_timeStamp;
+
+    // Same as the ones of HGParseRequest.
+    int m_startBlock;
+    int m_numOfBlocks;
+    int m_numOfTailBlocks;
+
+    // Format runs of each block, indexed by block number relative to
+    // m_startBlock.
+    QVector<QVector<HLFormatRun> > m_blocksHighlights;
+
+    // Snapshot of the format table of the parser, which the runs index into.
+    QVector<QTextCharFormat> m_formats;
+
+    // HighlightBlockFlag of each block.
+    QVector<int> m_blocksFlags;
+
+    // All HTML comment regions, with position relative to the start of
+    // the snapshot.
+    QVector<VCommentRegion> m_commentRegions;
+
+    // Time in microseconds spent on parsing the text and mapping the
+    // elements to blocks, for profiling.
+    qint64 m_parseTime;
+    qint64 m_mapTime;
+};
+
+// Run PEG Markdown Highlight in a separate thread.
+// HGMarkdownHighlighter feeds it with snapshots of the document tagged with a
+// time stamp. Any request or result whose time stamp is older than the latest
+// one passed to invalidate() is abandoned, and so is a parse in progress.
+class HGMarkdownParser : public QObject
+{
+    Q_OBJECT
+public:
+    explicit HGMarkdownParser(const QVector<HighlightingStyle> &p_styles,
+                              QObject *p_parent = 0);
+    ~HGMarkdownParser();
+
+    // Queue @p_request to parse. Any pending request not started yet will be
+    // replaced. Thread-safe.
+    void requestParse(const HGParseRequest &p_request);
+
+    // Mark results with time stamp older than @p_timeStamp as obsolete, and
+    // cancel the parse in progress if it is one of them. Thread-safe.
+    void invalidate(int p_timeStamp);
+
+    // Take the latest finished result. Return false if there is none.
+    // Thread-safe.
+    bool takeResult(HGParseResult &p_result);
+
+    // Memory cap of the memo of expensive rules of pmh, which keeps pasted
+    // HTML and unclosed emphasis from taking seconds to parse.
+    static const size_t c_memoSize;
+
+signals:
+    // Parse of request with @p_timeStamp finished. Call takeResult() to fetch it.
+    void parseFinished(int p_timeStamp);
+
+    // Used internally to wake up the parser thread.
+    void parseRequested();
+
+private slots:
+    void doParse();
+
+private:
+    bool isObsolete(int p_timeStamp) const;
+
+    // Cancel callback of pmh, called in the parser thread.
+    static int isParseCancelled(void *p_parser);
+
+    // Parse @p_text into m_pmhResult. Return false if the parse is cancelled.
+    bool parseText(const QString &p_text);
+
+    // Build m_blockStarts of @p_text.
+    void initBlockStarts(const QString &p_text);
+
+    void initBlockHighlightFromResult(HGParseResult &p_result);
+
+    // Map m_flatElements to blocks in one pass: the highlights of all
+    // styles, the flags of blocks and the HTML comment regions.
+    void mapElementsToBlocks(HGParseResult &p_result);
+
+    // Convert possibly overlapping @p_units of one block to disjoint runs.
+    void unitsToRuns(const HLUnit *p_units, int p_nrUnits,
+                     QVector<HLFormatRun> &p_runs);
+
+    // Get the index in m_formats of the merged format of styles in @p_mask.
+    int formatIndex(quint64 p_mask);
+
+    const QVector<HighlightingStyle> m_styles;
+
+    // Protect m_request and m_result.
+    QMutex m_mutex;
+
+    bool m_hasRequest;
+    HGParseRequest m_request;
+
+    bool m_hasResult;
+    HGParseResult m_result;
+
+    // The latest time stamp known by the highlighter.
+    QAtomicInt m_latestTimeStamp;
+
+    // Used only in the parser thread.
+    pmh_element **m_pmhResult;
+
+    // Time stamp of the request being parsed. Used only in the parser thread.
+    int m_parsingTimeStamp;
+
+    // Keep the buffers and memory of pmh warm across parses. m_pmhResult is
+    // owned by it.
+    pmh_context *m_pmhContext;
+
+    // Parse large text in chunks concurrently. m_pmhResult may be owned by
+    // it instead.
+    HGParallelParser m_parallelParser;
+
+    // Size of the largest text parsed since m_pmhContext and
+    // m_parallelParser are reset.
+    size_t m_warmTextSize;
+
+    // Elements of m_pmhResult sorted by position.
+    pmh_flat_elements m_flatElements;
+
+    // Indexes of the styles of each element type.
+    QVector<int> m_stylesOfType[pmh_NUM_LANG_TYPES];
+
+    // Start position of each block of current text, with an extra end position.
+    QVector<unsigned long> m_blockStarts;
+
+    // A highlight unit and the block it belongs to.
+    struct BlockUnit
+    {
+        int m_blockNum;
+        HLUnit m_unit;
+    };
+
+    // Number of units of last parse, used to reserve space.
+    int m_numOfUnitsHint;
+
+    // Start or end of a unit.
+    struct UnitBound
+    {
+        unsigned long m_pos;
+        int m_styleIndex;
+        // 1 for start and -1 for end.
+        int m_delta;
+
+        bool operator<(const UnitBound &p_a) const
+        {
+            return m_pos < p_a.m_pos;
+        }
+    };
+
+    // Reused by unitsToRuns().
+    QVector<UnitBound> m_bounds;
+
+    // Format table. The format at index i is the merged format of styles in
+    // the mask mapping to i. Styles are merged in the order of m_styles.
+    QVector<QTextCharFormat> m_formats;
+    QHash<quint64, int> m_formatIndexes;
+
+    // Max number of styles a format mask could hold.
+    static const int c_maxNumOfStyles = 64;
+
+    // Context warmed by text smaller than this is always kept.
+    static const size_t c_minWarmTextSize;
+};
+
+#endif // HGMARKDOWNPARSER_H
@@ -0,0 +1,118 @@
+#include "hgmarkdownscanner.h"
+
+// Skip leading spaces and a "```". Return the index after the "```", or -1
+// if @p_data does not start with one.
+static int skipFence(const QChar *p_data, int p_len)
+{
+    int i = 0;
+    while (i < p_len && p_data[i].isSpace()) {
+        ++i;
+    }
+
+    if (i + 3 > p_len
+        || p_data[i] != QChar('`')
+        || p_data[i + 1] != QChar('`')
+        || p_data[i + 2] != QChar('`')) {
+        return -1;
+    }
+
+    return i + 3;
+}
+
+// Try to match a link `[...](...)` whose '[' is at @p_idx. Return the end
+// index of the link, or -1 if it does not match.
+// @p_hasSpace: whether the URL contains spaces.
+static int matchLink(const QChar *p_data, int p_len, int p_idx, bool &p_hasSpace)
+{
+    Q_ASSERT(p_data[p_idx] == QChar('['));
+    int i = p_idx + 1;
+    while (i < p_len && p_data[i] != QChar(']')) {
+        ++i;
+    }
+
+    // "](" and at least one character of URL.
+    if (i + 2 >= p_len || p_data[i + 1] != QChar('(')) {
+        return -1;
+    }
+
+    i += 2;
+    int urlStart = i;
+    p_hasSpace = false;
+    for (; i < p_len; ++i) {
+        QChar ch = p_data[i];
+        if (ch == QChar(')')) {
+            break;
+        } else if (ch == QChar('\n')) {
+            return -1;
+        } else if (ch == QChar(' ')) {
+            p_hasSpace = true;
+        }
+    }
+
+    if (i == p_len || i == urlStart) {
+        return -1;
+    }
+
+    return i + 1;
+}
+
+void HGMarkdownScanner::scanBlock(const QString &p_text, bool p_inCodeBlock,
+                                  bool p_withLinks, HGBlockScanResult &p_result)
+{
+    p_result.m_fence = HGBlockScanResult::NoFence;
+    p_result.m_langStart = p_result.m_langLength = 0;
+    p_result.m_links.resize(0);
+
+    const QChar *data = p_text.constData();
+    int len = p_text.size();
+
+    int idx = skipFence(data, len);
+    if (idx != -1) {
+        if (p_inCodeBlock) {
+            // Nothing but the "```".
+            if (idx == len) {
+                p_result.m_fence = HGBlockScanResult::FenceEnd;
+            }
+        } else {
+            p_result.m_fence = HGBlockScanResult::FenceStart;
+            p_result.m_langStart = idx;
+            while (idx < len && !data[idx].isSpace()) {
+                ++idx;
+            }
+
+            p_result.m_langLength = idx - p_result.m_langStart;
+        }
+    }
+
+    if (!p_withLinks || p_inCodeBlock || p_result.m_fence != HGBlockScanResult::NoFence) {
+        return;
+    }
+
+    // Links do not overlap. The search of next link starts from @searchStart.
+    int searchStart = 0;
+    int i = 0;
+    while (i < len) {
+        if (data[i] != QChar('[')) {
+            ++i;
+            continue;
+        }
+
+        bool hasSpace = false;
+        int end = matchLink(data, len, i, hasSpace);
+        if (end == -1) {
+            ++i;
+            continue;
+        }
+
+        if (hasSpace) {
+            bool isImage = i > searchStart && data[i - 1] == QChar('!');
+            HGLinkSpan link;
+            link.m_start = isImage ? i - 1 : i;
+            link.m_length = end - link.m_start;
+            link.m_isImage = isImage;
+            p_result.m_links.append(link);
+        }
+
+        i = searchStart = end;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef HGMARKDOWNSCANNER_H
+#define HGMARKDOWNSCANNER_H
+
+#include <QString>
+#include <QVector>
+
+// A link or image `[...](...)` with spaces in the URL within a block.
+struct HGLinkSpan
+{
+    int m_start;
+    int m_length;
+    bool m_isImage;
+};
+
+// Result of scanning one block.
+struct HGBlockScanResult
+{
+    enum FenceType
+    {
+        // Not a fence line.
+        NoFence = 0,
+
+        // A line starting a fenced code block.
+        FenceStart,
+
+        // A line closing a fenced code block.
+        FenceEnd
+    };
+
+    HGBlockScanResult() : m_fence(NoFence), m_langStart(0), m_langLength(0)
+    {
+    }
+
+    FenceType m_fence;
+
+    // Language of the fence start.
+    int m_langStart;
+    int m_langLength;
+
+    // Links with spaces in URL. Only for blocks outside fenced code blocks.
+    QVector<HGLinkSpan> m_links;
+};
+
+// Scan the text of a block for what PEG Markdown Highlight does not handle,
+// that is fenced code blocks and links with spaces in the URL.
+namespace HGMarkdownScanner
+{
+    // Scan @p_text of a block.
+    // @p_inCodeBlock: whether the previous block is inside a fenced code block.
+    // @p_withLinks: whether to look for links.
+    // @p_result will be reset and the capacity of m_links is kept.
+    void scanBlock(const QString &p_text, bool p_inCodeBlock, bool p_withLinks,
+                   HGBlockScanResult &p_result);
+
+    // Whether the block with @p_result and @p_inCodeBlock is part of a
+    // fenced code block, including the fence lines.
+    inline bool isCodeBlockLine(const HGBlockScanResult &p_result, bool p_inCodeBlock)
+    {
+        return p_inCodeBlock || p_result.m_fence == HGBlockScanResult::FenceStart;
+    }
+
+    // Whether the block after the block with @p_result is inside a fenced code
+    // block.
+    inline bool continuesCodeBlock(const HGBlockScanResult &p_result, bool p_inCodeBlock)
+    {
+        return p_inCodeBlock ? p_result.m_fence != HGBlockScanResult::FenceEnd
+                             : p_result.m_fence == HGBlockScanResult::FenceStart;
+    }
+}
+
+#endif // HGMARKDOWNSCANNER_H
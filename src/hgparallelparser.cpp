@@ -0,0 +1,511 @@
+#include "hgparallelparser.h"
+
+#include <QDebug>
+#include <QRunnable>
+#include <QSet>
+#include <QThread>
+#include <algorithm>
+#include <string.h>
+
+const int HGParallelParser::c_minChunkSize = 256 * 1024;
+
+// Tags of the HTML blocks of PEG Markdown Highlight.
+static const char *c_blockTags[] = {
+    "address", "blockquote", "center", "dd", "dir", "div", "dl", "dt",
+    "fieldset", "form", "frameset", "h1", "h2", "h3", "h4", "h5", "h6",
+    "head", "li", "menu", "noframes", "noscript", "ol", "p", "pre", "script",
+    "table", "tbody", "td", "tfoot", "th", "thead", "tr", "ul", NULL
+};
+
+// Parse a chunk in a thread of the pool.
+class HGChunkParseTask : public QRunnable
+{
+public:
+    explicit HGChunkParseTask(HGParseChunk *p_chunk) : m_chunk(p_chunk)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        m_chunk->m_status = pmh_context_parse_utf16(m_chunk->m_context,
+                                                    m_chunk->m_text.utf16(),
+                                                    m_chunk->m_text.size(),
+                                                    pmh_EXT_NONE,
+                                                    &m_chunk->m_result);
+    }
+
+private:
+    HGParseChunk *m_chunk;
+};
+
+static bool isBlankLine(const ushort *p_line, int p_len)
+{
+    for (int i = 0; i < p_len; ++i) {
+        ushort ch = p_line[i];
+        if (ch != ' ' && ch != '\t' && ch != '\r') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Same as skipFence() of HGMarkdownScanner. Return the index after the "```"
+// of @p_line, or -1 if it is not a fence line.
+static int skipFence(const ushort *p_line, int p_len)
+{
+    int i = 0;
+    while (i < p_len && (p_line[i] == ' ' || p_line[i] == '\t')) {
+        ++i;
+    }
+
+    if (i + 3 > p_len || p_line[i] != '`' || p_line[i + 1] != '`' || p_line[i + 2] != '`') {
+        return -1;
+    }
+
+    return i + 3;
+}
+
+// Whether @p_text starts with tag name @p_tag, ignoring case.
+static bool startsWithTag(const ushort *p_text, int p_len, const char *p_tag)
+{
+    int tagLen = strlen(p_tag);
+    if (p_len < tagLen) {
+        return false;
+    }
+
+    for (int i = 0; i < tagLen; ++i) {
+        ushort ch = p_text[i];
+        if (ch >= 'A' && ch <= 'Z') {
+            ch = ch - 'A' + 'a';
+        }
+
+        if (ch != p_tag[i]) {
+            return false;
+        }
+    }
+
+    if (p_len == tagLen) {
+        return true;
+    }
+
+    ushort ch = p_text[tagLen];
+    return !((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9'));
+}
+
+static bool startsListItem(const ushort *p_line, int p_len)
+{
+    if (p_len >= 2
+        && (p_line[0] == '-' || p_line[0] == '*' || p_line[0] == '+')
+        && (p_line[1] == ' ' || p_line[1] == '\t')) {
+        return true;
+    }
+
+    int i = 0;
+    while (i < p_len && p_line[i] >= '0' && p_line[i] <= '9') {
+        ++i;
+    }
+
+    return i > 0 && i + 1 < p_len && p_line[i] == '.'
+           && (p_line[i + 1] == ' ' || p_line[i + 1] == '\t');
+}
+
+// Whether a chunk could start at @p_line, which follows a blank line outside
+// any fenced code block, HTML block or HTML comment. Lines which could
+// continue a list or a block quote are excluded.
+static bool canStartChunk(const ushort *p_line, int p_len)
+{
+    if (isBlankLine(p_line, p_len)) {
+        return false;
+    }
+
+    ushort ch = p_line[0];
+    if (ch == ' ' || ch == '\t' || ch == '>') {
+        return false;
+    }
+
+    return !startsListItem(p_line, p_len);
+}
+
+HGParallelParser::HGParallelParser()
+    : m_memoRules(pmh_MEMO_NONE), m_memoSize(0), m_cancelCallback(NULL),
+      m_cancelData(NULL), m_refContext(NULL), m_numOfChunks(0)
+{
+    memset(m_result, 0, sizeof(m_result));
+}
+
+HGParallelParser::~HGParallelParser()
+{
+    reset();
+}
+
+void HGParallelParser::setMemo(int p_rules, size_t p_maxBytes)
+{
+    m_memoRules = p_rules;
+    m_memoSize = p_maxBytes;
+    for (auto &chunk : m_chunks) {
+        pmh_context_set_memo(chunk.m_context, m_memoRules, m_memoSize);
+    }
+}
+
+void HGParallelParser::setCancel(pmh_cancel_callback p_callback, void *p_data)
+{
+    m_cancelCallback = p_callback;
+    m_cancelData = p_data;
+    for (auto &chunk : m_chunks) {
+        pmh_context_set_cancel(chunk.m_context, m_cancelCallback, m_cancelData, 0);
+    }
+
+    if (m_refContext) {
+        pmh_context_set_cancel(m_refContext, m_cancelCallback, m_cancelData, 0);
+    }
+}
+
+int HGParallelParser::maxNumOfChunks(int p_size)
+{
+    return qMin(QThread::idealThreadCount(), p_size / c_minChunkSize);
+}
+
+QVector<int> HGParallelParser::splitText(const QString &p_text, int p_maxChunks)
+{
+    QVector<int> starts;
+    starts.append(0);
+
+    const ushort *text = p_text.utf16();
+    int size = p_text.size();
+    bool inFence = false;
+    bool inComment = false;
+    // The HTML block we are in and the depth of its tag.
+    const char *blockTag = NULL;
+    int depth = 0;
+    bool prevBlank = true;
+    int pos = 0;
+    while (pos < size && starts.size() < p_maxChunks) {
+        const ushort *line = text + pos;
+        int len = 0;
+        while (pos + len < size && line[len] != '\n') {
+            ++len;
+        }
+
+        // Cut at the first safe line after the ideal start of next chunk.
+        if (prevBlank
+            && !inFence
+            && !inComment
+            && !blockTag
+            && pos >= (qint64)size * starts.size() / p_maxChunks
+            && canStartChunk(line, len)) {
+            starts.append(pos);
+        }
+
+        int idx = skipFence(line, len);
+        if (inFence) {
+            // Nothing but the "```".
+            if (idx == len) {
+                inFence = false;
+            }
+        } else if (idx != -1) {
+            inFence = true;
+        } else {
+            if (!blockTag) {
+                int i = 0;
+                while (i < len && line[i] == ' ') {
+                    ++i;
+                }
+
+                if (i < len && line[i] == '<') {
+                    for (int j = 0; c_blockTags[j]; ++j) {
+                        if (startsWithTag(line + i + 1, len - i - 1, c_blockTags[j])) {
+                            blockTag = c_blockTags[j];
+                            depth = 0;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // Track comments and the nested tags of the HTML block.
+            for (int i = 0; i < len; ++i) {
+                if (inComment) {
+                    if (i + 2 < len && line[i] == '-' && line[i + 1] == '-' && line[i + 2] == '>') {
+                        inComment = false;
+                        i += 2;
+                    }
+
+                    continue;
+                }
+
+                if (line[i] != '<') {
+                    continue;
+                }
+
+                if (i + 3 < len && line[i + 1] == '!' && line[i + 2] == '-' && line[i + 3] == '-') {
+                    inComment = true;
+                    i += 3;
+                } else if (blockTag) {
+                    if (i + 1 < len && line[i + 1] == '/') {
+                        if (startsWithTag(line + i + 2, len - i - 2, blockTag) && --depth == 0) {
+                            blockTag = NULL;
+                        }
+                    } else if (startsWithTag(line + i + 1, len - i - 1, blockTag)) {
+                        ++depth;
+                    }
+                }
+            }
+        }
+
+        prevBlank = isBlankLine(line, len);
+        pos += len + 1;
+    }
+
+    return starts;
+}
+
+void HGParallelParser::initContext(HGParseChunk &p_chunk)
+{
+    if (p_chunk.m_context) {
+        return;
+    }
+
+    p_chunk.m_context = pmh_context_create();
+    pmh_context_set_memo(p_chunk.m_context, m_memoRules, m_memoSize);
+    pmh_context_set_cancel(p_chunk.m_context, m_cancelCallback, m_cancelData, 0);
+}
+
+static bool referenceLess(const pmh_element *p_a, const pmh_element *p_b)
+{
+    return p_a->pos < p_b->pos;
+}
+
+bool HGParallelParser::collectReferences(const QString &p_text, QString &p_refs)
+{
+    p_refs.clear();
+
+    if (!m_refContext) {
+        m_refContext = pmh_context_create();
+        pmh_context_set_cancel(m_refContext, m_cancelCallback, m_cancelData, 0);
+    }
+
+    pmh_element *refList = NULL;
+    if (pmh_context_parse_references_utf16(m_refContext, p_text.utf16(), p_text.size(),
+                                           pmh_EXT_NONE, &refList) != pmh_PARSE_DONE) {
+        return false;
+    }
+
+    QVector<pmh_element *> refs;
+    for (pmh_element *elem = refList; elem; elem = elem->next) {
+        refs.append(elem);
+    }
+
+    std::sort(refs.begin(), refs.end(), referenceLess);
+
+    QSet<QString> added;
+    for (auto const *elem : refs) {
+        // Duplicated definitions would be found in every chunk.
+        QString ref = p_text.mid(elem->pos, elem->end - elem->pos);
+        if (added.contains(ref)) {
+            continue;
+        }
+
+        added.insert(ref);
+        p_refs.append(ref);
+        if (!p_refs.endsWith('\n')) {
+            p_refs.append('\n');
+        }
+    }
+
+    if (!p_refs.isEmpty()) {
+        p_refs.append('\n');
+    }
+
+    return true;
+}
+
+bool HGParallelParser::parse(const QString &p_text, int p_maxChunks,
+                             pmh_element ***p_result)
+{
+    memset(m_result, 0, sizeof(m_result));
+    *p_result = NULL;
+
+    QVector<int> starts = splitText(p_text, p_maxChunks);
+    m_numOfChunks = starts.size();
+    if (m_chunks.size() < m_numOfChunks) {
+        m_chunks.resize(m_numOfChunks);
+    }
+
+    if (m_numOfChunks == 1) {
+        HGParseChunk &chunk = m_chunks[0];
+        initContext(chunk);
+        return pmh_context_parse_utf16(chunk.m_context, p_text.utf16(), p_text.size(),
+                                       pmh_EXT_NONE, p_result) == pmh_PARSE_DONE;
+    }
+
+    QString refs;
+    if (!collectReferences(p_text, refs)) {
+        return false;
+    }
+
+    for (int i = 0; i < m_numOfChunks; ++i) {
+        HGParseChunk &chunk = m_chunks[i];
+        initContext(chunk);
+        int start = starts[i];
+        int end = i < m_numOfChunks - 1 ? starts[i + 1] : p_text.size();
+        chunk.m_text = refs;
+        chunk.m_text.append(p_text.midRef(start, end - start));
+        chunk.m_prefixLength = refs.size();
+        chunk.m_length = end - start;
+        chunk.m_isLast = i == m_numOfChunks - 1;
+        chunk.m_status = pmh_PARSE_DONE;
+        chunk.m_result = NULL;
+    }
+
+    // Parse the first chunk in current thread.
+    for (int i = 1; i < m_numOfChunks; ++i) {
+        m_pool.start(new HGChunkParseTask(&m_chunks[i]));
+    }
+
+    HGChunkParseTask(&m_chunks[0]).run();
+    m_pool.waitForDone();
+
+    for (int i = 0; i < m_numOfChunks; ++i) {
+        if (m_chunks[i].m_status != pmh_PARSE_DONE) {
+            return false;
+        }
+    }
+
+    pmh_element *tails[pmh_NUM_TYPES];
+    memset(tails, 0, sizeof(tails));
+    unsigned long offset = 0;
+    for (int i = 0; i < m_numOfChunks; ++i) {
+        mergeChunk(m_chunks[i], offset, tails);
+        offset += m_chunks[i].m_length;
+    }
+
+    Q_ASSERT(matchesSerialParse(p_text));
+
+    *p_result = m_result;
+    return true;
+}
+
+void HGParallelParser::mergeChunk(const HGParseChunk &p_chunk, unsigned long p_offset,
+                                  pmh_element **p_tails)
+{
+    for (int type = 0; type < pmh_NUM_LANG_TYPES; ++type) {
+        pmh_element *elem = p_chunk.m_result[type];
+        while (elem) {
+            pmh_element *next = elem->next;
+
+            // Drop elements of the reference definitions, and the ones after
+            // the chunk which belong to next chunk. Elements ending with
+            // blank lines at the end of the chunk are clipped there, as they
+            // end before next chunk in the whole text.
+            bool keep = false;
+            if (elem->pos >= p_chunk.m_prefixLength) {
+                elem->pos -= p_chunk.m_prefixLength;
+                elem->end -= p_chunk.m_prefixLength;
+                if (p_chunk.m_isLast || elem->pos < p_chunk.m_length) {
+                    keep = true;
+                    if (!p_chunk.m_isLast && elem->end > p_chunk.m_length) {
+                        elem->end = p_chunk.m_length;
+                    }
+                }
+            }
+
+            if (keep) {
+                elem->pos += p_offset;
+                elem->end += p_offset;
+                elem->next = NULL;
+                if (p_tails[type]) {
+                    p_tails[type]->next = elem;
+                } else {
+                    m_result[type] = elem;
+                }
+
+                p_tails[type] = elem;
+            }
+
+            elem = next;
+        }
+    }
+}
+
+// Type and position of an element, to compare elements regardless of order.
+struct HGElementPos
+{
+    int m_type;
+    unsigned long m_pos;
+    unsigned long m_end;
+
+    bool operator<(const HGElementPos &p_a) const
+    {
+        if (m_pos != p_a.m_pos) {
+            return m_pos < p_a.m_pos;
+        } else if (m_end != p_a.m_end) {
+            return m_end < p_a.m_end;
+        } else {
+            return m_type < p_a.m_type;
+        }
+    }
+
+    bool operator==(const HGElementPos &p_a) const
+    {
+        return m_type == p_a.m_type && m_pos == p_a.m_pos && m_end == p_a.m_end;
+    }
+};
+
+static void collectElements(pmh_element **p_elements, QVector<HGElementPos> &p_poses)
+{
+    for (int type = 0; type < pmh_NUM_LANG_TYPES; ++type) {
+        for (const pmh_element *elem = p_elements[type]; elem; elem = elem->next) {
+            HGElementPos pos;
+            pos.m_type = type;
+            pos.m_pos = elem->pos;
+            pos.m_end = elem->end;
+            p_poses.append(pos);
+        }
+    }
+
+    std::sort(p_poses.begin(), p_poses.end());
+}
+
+bool HGParallelParser::sameElements(pmh_element **p_a, pmh_element **p_b)
+{
+    QVector<HGElementPos> a, b;
+    collectElements(p_a, a);
+    collectElements(p_b, b);
+    return a == b;
+}
+
+bool HGParallelParser::matchesSerialParse(const QString &p_text)
+{
+    pmh_context *context = pmh_context_create();
+    pmh_context_set_memo(context, m_memoRules, m_memoSize);
+    pmh_context_set_cancel(context, m_cancelCallback, m_cancelData, 0);
+
+    pmh_element **result = NULL;
+    bool matched = true;
+    if (pmh_context_parse_utf16(context, p_text.utf16(), p_text.size(),
+                                pmh_EXT_NONE, &result) == pmh_PARSE_DONE) {
+        matched = sameElements(m_result, result);
+        if (!matched) {
+            qWarning() << "parallel parse differs from serial parse, chunks:"
+                       << m_numOfChunks;
+        }
+    }
+
+    pmh_context_destroy(context);
+    return matched;
+}
+
+void HGParallelParser::reset()
+{
+    memset(m_result, 0, sizeof(m_result));
+    for (auto &chunk : m_chunks) {
+        pmh_context_destroy(chunk.m_context);
+    }
+
+    m_chunks.clear();
+    m_numOfChunks = 0;
+
+    pmh_context_destroy(m_refContext);
+    m_refContext = NULL;
+}
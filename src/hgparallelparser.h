@@ -0,0 +1,122 @@
+#ifndef HGPARALLELPARSER_H
+#define HGPARALLELPARSER_H
+
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+extern "C" {
+#include <pmh_parser.h>
+}
+
+// A chunk of the text parsed by HGParallelParser.
+struct HGParseChunk
+{
+    HGParseChunk() : m_context(NULL), m_prefixLength(0), m_length(0),
+                     m_isLast(false), m_status(pmh_PARSE_DONE), m_result(NULL)
+    {
+    }
+
+    // Keep the buffers and memory of pmh warm across parses.
+    pmh_context *m_context;
+
+    // Reference definitions of the whole text followed by the chunk.
+    QString m_text;
+
+    // Code units of the reference definitions and of the chunk.
+    unsigned long m_prefixLength;
+    unsigned long m_length;
+
+    // Whether it is the last chunk of the text.
+    bool m_isLast;
+
+    pmh_parse_status m_status;
+    pmh_element **m_result;
+};
+
+// Parse large Markdown text with PEG Markdown Highlight in chunks
+// concurrently.
+// The text is split at blank lines where no element could continue, that is
+// outside fenced code blocks, HTML blocks and HTML comments. Every chunk is
+// parsed along with the reference definitions of the whole text, so reference
+// links are resolved like in a parse of the whole text. The elements of all
+// chunks are merged into one result of the same shape as the one of
+// pmh_context_parse().
+class HGParallelParser
+{
+public:
+    HGParallelParser();
+    ~HGParallelParser();
+
+    // Same as pmh_context_set_memo() and pmh_context_set_cancel(), for the
+    // parses of all chunks.
+    void setMemo(int p_rules, size_t p_maxBytes);
+    void setCancel(pmh_cancel_callback p_callback, void *p_data);
+
+    // Max number of chunks worth splitting text of @p_size code units into.
+    static int maxNumOfChunks(int p_size);
+
+    // Split @p_text into at most @p_maxChunks chunks of about the same size.
+    // Return the start offset of each chunk.
+    static QVector<int> splitText(const QString &p_text, int p_maxChunks);
+
+    // Parse @p_text in at most @p_maxChunks chunks. @p_result is owned
+    // by this object and is valid until next parse() or reset(). Return false
+    // if the parse is cancelled.
+    bool parse(const QString &p_text, int p_maxChunks,
+               pmh_element ***p_result);
+
+    // Number of chunks of the last parse.
+    int numOfChunks() const;
+
+    // Whether element lists @p_a and @p_b hold elements of the same types
+    // and positions, regardless of their order in the lists.
+    static bool sameElements(pmh_element **p_a, pmh_element **p_b);
+
+    // Release the memory of all the contexts.
+    void reset();
+
+    // Chunks smaller than this, in code units, are not worth a thread.
+    static const int c_minChunkSize;
+
+private:
+    // Create the context of @p_chunk if needed.
+    void initContext(HGParseChunk &p_chunk);
+
+    // Get the reference definitions of @p_text, one after another.
+    bool collectReferences(const QString &p_text, QString &p_refs);
+
+    // Move the elements of @p_chunk to m_result, starting at @p_offset.
+    void mergeChunk(const HGParseChunk &p_chunk, unsigned long p_offset,
+                    pmh_element **p_tails);
+
+    // Whether m_result is the same as the result of parsing @p_text as a
+    // whole. Used to check the merge in debug builds, which doubles the
+    // time of a parse. Return true if the check is cancelled.
+    bool matchesSerialParse(const QString &p_text);
+
+    int m_memoRules;
+    size_t m_memoSize;
+
+    pmh_cancel_callback m_cancelCallback;
+    void *m_cancelData;
+
+    // Used to find the reference definitions.
+    pmh_context *m_refContext;
+
+    QVector<HGParseChunk> m_chunks;
+    int m_numOfChunks;
+
+    // Threads to parse all the chunks but the first one.
+    QThreadPool m_pool;
+
+    // Merged elements, indexed by type.
+    pmh_element *m_result[pmh_NUM_TYPES];
+};
+
+inline int HGParallelParser::numOfChunks() const
+{
+    return m_numOfChunks;
+}
+
+#endif // HGPARALLELPARSER_H
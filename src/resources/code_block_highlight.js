@@ -0,0 +1,45 @@
+// Highlight code blocks of all the editors with highlight.js in one hidden
+// page, which is driven by VCodeBlockHighlightService.
+var content;
+
+new QWebChannel(qt.webChannelTransport,
+    function(channel) {
+        content = channel.objects.content;
+        content.requestHighlightTexts.connect(highlightTexts);
+        content.noticeReadyToHighlightText();
+    });
+
+// Highlight the fenced code block @text and return the HTML, which is the
+// same as the one of Marked.
+var highlightTextToHtml = function(text) {
+    var lines = text.split('\n');
+
+    // The language is the first word of the info string of the fence.
+    var lang = lines[0].replace(/^\s*(`{3,}|~{3,})\s*/, '').split(/\s/)[0];
+    var code = lines.slice(1, lines.length - 1).join('\n');
+
+    var html = '';
+    try {
+        if (lang && hljs.getLanguage(lang)) {
+            html = hljs.highlight(lang, code).value;
+        } else {
+            html = hljs.highlightAuto(code).value;
+        }
+    } catch (err) {
+        // Always send back a result so the batch will be finished.
+        content.setLog("fail to highlight code block: " + err);
+    }
+
+    return '<pre><code>' + html + '\n</code></pre>';
+};
+
+// Highlight code blocks in one batch and send back all the results at once.
+// @texts: array of {id, text}.
+var highlightTexts = function(texts, timeStamp) {
+    var results = [];
+    for (var i = 0; i < texts.length; ++i) {
+        results.push({ id: texts[i].id, html: highlightTextToHtml(texts[i].text) });
+    }
+
+    content.highlightTextsCB(results, timeStamp);
+};
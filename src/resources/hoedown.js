@@ -64,8 +64,3 @@ var updateHtml = function(html) {
     }
 };
 
-var highlightText = function(text, id, timeStamp) {
-    var html = marked(text);
-    content.highlightTextCB(html, id, timeStamp);
-}
-
@@ -105,8 +105,3 @@ var updateText = function(text) {
     }
 };
 
-var highlightText = function(text, id, timeStamp) {
-    var html = mdit.render(text);
-    content.highlightTextCB(html, id, timeStamp);
-}
-
@@ -34,11 +34,6 @@ new QWebChannel(qt.webChannelTransport,
             content.updateText();
         }
         content.requestScrollToAnchor.connect(scrollToAnchor);
-
-        if (typeof highlightText == "function") {
-            content.requestHighlightText.connect(highlightText);
-            content.noticeReadyToHighlightText();
-        }
     });
 
 var g_muteScroll = false;
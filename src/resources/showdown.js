@@ -87,17 +87,3 @@ var updateText = function(text) {
     }
 };
 
-var highlightText = function(text, id, timeStamp) {
-    var html = renderer.makeHtml(text);
-
-    var parser = new DOMParser();
-    var htmlDoc = parser.parseFromString("<div id=\"showdown-container\">" + html + "</div>", 'text/html');
-    highlightCodeBlocks(htmlDoc, false);
-
-    html = htmlDoc.getElementById('showdown-container').innerHTML;
-
-    delete parser;
-
-    content.highlightTextCB(html, id, timeStamp);
-}
-
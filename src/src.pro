@@ -30,6 +30,10 @@ SOURCES += main.cpp\
     utils/vutils.cpp \
     vpreviewpage.cpp \
     hgmarkdownhighlighter.cpp \
+    hgmarkdownparser.cpp \
+    hgmarkdownscanner.cpp \
+    hgparallelparser.cpp \
+    hgcodeblocktokenizer.cpp \
     vstyleparser.cpp \
     dialog/vnewnotebookdialog.cpp \
     vmarkdownconverter.cpp \
@@ -60,6 +64,7 @@ SOURCES += main.cpp\
     vopenedlistmenu.cpp \
     vorphanfile.cpp \
     vcodeblockhighlighthelper.cpp \
+    vcodeblockhighlightservice.cpp \
     vwebview.cpp \
     vimagepreviewer.cpp \
     vexporter.cpp \
@@ -80,6 +85,10 @@ HEADERS  += vmainwindow.h \
     utils/vutils.h \
     vpreviewpage.h \
     hgmarkdownhighlighter.h \
+    hgmarkdownparser.h \
+    hgmarkdownscanner.h \
+    hgparallelparser.h \
+    hgcodeblocktokenizer.h \
     vstyleparser.h \
     dialog/vnewnotebookdialog.h \
     vmarkdownconverter.h \
@@ -111,6 +120,7 @@ HEADERS  += vmainwindow.h \
     vnavigationmode.h \
     vorphanfile.h \
     vcodeblockhighlighthelper.h \
+    vcodeblockhighlightservice.h \
     vwebview.h \
     vimagepreviewer.h \
     vexporter.h \
@@ -2,21 +2,116 @@
 
 #include <QDebug>
 #include <QStringList>
-#include "vdocument.h"
+#include <QCryptographicHash>
+#include <QJsonObject>
+#include <QWidget>
+#include <algorithm>
+#include "hgcodeblocktokenizer.h"
+#include "vnote.h"
 #include "utils/vutils.h"
 
+extern VNote *g_vnote;
+
+const int VCodeBlockHighlightHelper::c_cacheMaxUnits = 256 * 1024;
+
+QCache<QByteArray, QVector<HLUnitPos> > VCodeBlockHighlightHelper::s_cache(c_cacheMaxUnits);
+
+// Map positions between the text of a code block and its unindented text,
+// which lacks some leading spaces of each line.
+class VIndentMap
+{
+public:
+    VIndentMap(const QString &p_text, const QString &p_unindentedText)
+        : m_identical(p_text.size() == p_unindentedText.size())
+    {
+        if (!m_identical) {
+            initLineStarts(p_text, m_starts);
+            initLineStarts(p_unindentedText, m_unindentedStarts);
+            Q_ASSERT(m_starts.size() == m_unindentedStarts.size());
+        }
+    }
+
+    int toUnindented(int p_pos) const
+    {
+        if (m_identical) {
+            return p_pos;
+        }
+
+        // Positions within the removed spaces go to the start of the line.
+        int line = lineOf(m_starts, p_pos);
+        return m_unindentedStarts[line] + qMax(p_pos - m_starts[line] - indentOf(line), 0);
+    }
+
+    int fromUnindented(int p_pos) const
+    {
+        if (m_identical) {
+            return p_pos;
+        }
+
+        int line = lineOf(m_unindentedStarts, p_pos);
+        return m_starts[line] + indentOf(line) + p_pos - m_unindentedStarts[line];
+    }
+
+private:
+    // Start of each line, followed by the end of the text plus one.
+    static void initLineStarts(const QString &p_text, QVector<int> &p_starts)
+    {
+        p_starts.append(0);
+        for (int i = 0; i < p_text.size(); ++i) {
+            if (p_text[i] == QChar('\n')) {
+                p_starts.append(i + 1);
+            }
+        }
+
+        p_starts.append(p_text.size() + 1);
+    }
+
+    static int lineOf(const QVector<int> &p_starts, int p_pos)
+    {
+        int line = std::upper_bound(p_starts.begin(), p_starts.end() - 1, p_pos)
+                   - p_starts.begin() - 1;
+        return qMax(line, 0);
+    }
+
+    // Number of spaces removed from line @p_line.
+    int indentOf(int p_line) const
+    {
+        return (m_starts[p_line + 1] - m_starts[p_line])
+               - (m_unindentedStarts[p_line + 1] - m_unindentedStarts[p_line]);
+    }
+
+    bool m_identical;
+    QVector<int> m_starts;
+    QVector<int> m_unindentedStarts;
+};
+
 VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_highlighter,
-                                                     VDocument *p_vdoc,
-                                                     MarkdownConverterType p_type)
-    : QObject(p_highlighter), m_highlighter(p_highlighter), m_vdocument(p_vdoc),
-      m_type(p_type), m_timeStamp(0)
+                                                     const QWidget *p_editor)
+    : QObject(p_highlighter), m_highlighter(p_highlighter), m_editor(p_editor),
+      m_service(g_vnote->getCodeBlockHighlightService()), m_timeStamp(0)
 {
     connect(m_highlighter, &HGMarkdownHighlighter::codeBlocksUpdated,
             this, &VCodeBlockHighlightHelper::handleCodeBlocksUpdated);
-    connect(m_vdocument, &VDocument::textHighlighted,
-            this, &VCodeBlockHighlightHelper::handleTextHighlightResult);
-    connect(m_vdocument, &VDocument::readyToHighlightText,
-            m_highlighter, &HGMarkdownHighlighter::updateHighlight);
+}
+
+VCodeBlockHighlightHelper::~VCodeBlockHighlightHelper()
+{
+    if (m_service) {
+        m_service->removeClient(this);
+    }
+}
+
+VCodeBlockHighlightService::Priority VCodeBlockHighlightHelper::getPriority() const
+{
+    if (!m_editor->isVisible()) {
+        return VCodeBlockHighlightService::Background;
+    }
+
+    if (m_editor->hasFocus()) {
+        return VCodeBlockHighlightService::Focused;
+    }
+
+    return VCodeBlockHighlightService::Visible;
 }
 
 QString VCodeBlockHighlightHelper::unindentCodeBlock(const QString &p_text)
@@ -56,54 +151,220 @@ void VCodeBlockHighlightHelper::handleCodeBlocksUpdated(const QList<VCodeBlock>
 {
     int curStamp = m_timeStamp.fetchAndAddRelaxed(1) + 1;
     m_codeBlocks = p_codeBlocks;
-    for (int i = 0; i < m_codeBlocks.size(); ++i) {
-        QString unindentedText = unindentCodeBlock(m_codeBlocks[i].m_text);
-        m_vdocument->highlightTextAsync(unindentedText, i, curStamp);
+    int nrBlocks = m_codeBlocks.size();
+    m_unindentedTexts.resize(nrBlocks);
+    m_cacheKeys.resize(nrBlocks);
+
+    // Highlights of the code blocks got at once.
+    QList<HLUnitPos> hlUnits;
+    QVector<int> highlightedIds;
+
+    // Code blocks for highlight.js in the web page. Those visible in the
+    // editor go first so that they come back in the first batch.
+    QJsonArray texts;
+    QJsonArray invisibleTexts;
+    int firstVisibleBlock = m_highlighter->getFirstVisibleBlock();
+    int lastVisibleBlock = m_highlighter->getLastVisibleBlock();
+
+    for (int i = 0; i < nrBlocks; ++i) {
+        const VCodeBlock &block = m_codeBlocks.at(i);
+        m_unindentedTexts[i] = unindentCodeBlock(block.m_text);
+        m_cacheKeys[i] = cacheKey(block.m_lang, m_unindentedTexts[i]);
+
+        if (getCachedHighlights(i, hlUnits)) {
+            highlightedIds.append(block.m_id);
+            continue;
+        }
+
+        // Tokenize natively if possible.
+        QList<HLUnitPos> blockUnits;
+        if (HGCodeBlockTokenizer::tokenize(block, blockUnits)) {
+            cacheHighlights(i, blockUnits);
+            hlUnits.append(blockUnits);
+            highlightedIds.append(block.m_id);
+            continue;
+        }
+
+        QJsonObject obj;
+        obj["id"] = i;
+        obj["text"] = m_unindentedTexts[i];
+        if (block.m_endBlock >= firstVisibleBlock && block.m_startBlock <= lastVisibleBlock) {
+            texts.append(obj);
+        } else {
+            invisibleTexts.append(obj);
+        }
+    }
+
+    for (auto const &obj : invisibleTexts) {
+        texts.append(obj);
+    }
+
+    if (!highlightedIds.isEmpty()) {
+        m_highlighter->setCodeBlockHighlights(hlUnits, highlightedIds);
+    }
+
+    // Texts requested before are dropped even if there is none to request.
+    if (m_service) {
+        m_service->highlightTexts(this, texts, curStamp);
     }
 }
 
-void VCodeBlockHighlightHelper::handleTextHighlightResult(const QString &p_html,
-                                                          int p_id,
-                                                          int p_timeStamp)
+QByteArray VCodeBlockHighlightHelper::cacheKey(const QString &p_lang,
+                                               const QString &p_unindentedText)
+{
+    QByteArray data = QByteArray::fromRawData((const char *)p_unindentedText.constData(),
+                                              p_unindentedText.size() * sizeof(QChar));
+    QByteArray key = p_lang.toLower().toUtf8();
+    key.append(' ');
+    key.append(QCryptographicHash::hash(data, QCryptographicHash::Md5));
+    return key;
+}
+
+bool VCodeBlockHighlightHelper::getCachedHighlights(int p_idx,
+                                                    QList<HLUnitPos> &p_units) const
+{
+    const QVector<HLUnitPos> *units = s_cache.object(m_cacheKeys[p_idx]);
+    if (!units) {
+        return false;
+    }
+
+    const VCodeBlock &block = m_codeBlocks.at(p_idx);
+    VIndentMap indentMap(block.m_text, m_unindentedTexts[p_idx]);
+    p_units.reserve(p_units.size() + units->size());
+    for (auto const &unit : *units) {
+        int start = indentMap.fromUnindented(unit.m_position);
+        int end = indentMap.fromUnindented(unit.m_position + unit.m_length);
+        p_units.append(HLUnitPos(block.m_startPos + start, end - start, unit.m_style));
+    }
+
+    return true;
+}
+
+void VCodeBlockHighlightHelper::cacheHighlights(int p_idx,
+                                                const QList<HLUnitPos> &p_units) const
+{
+    const VCodeBlock &block = m_codeBlocks.at(p_idx);
+    VIndentMap indentMap(block.m_text, m_unindentedTexts[p_idx]);
+    QVector<HLUnitPos> *units = new QVector<HLUnitPos>();
+    units->reserve(p_units.size());
+    for (auto const &unit : p_units) {
+        int start = indentMap.toUnindented(unit.m_position - block.m_startPos);
+        int end = indentMap.toUnindented(unit.m_position + unit.m_length - block.m_startPos);
+        units->append(HLUnitPos(start, end - start, unit.m_style));
+    }
+
+    s_cache.insert(m_cacheKeys[p_idx], units, units->size() + 1);
+}
+
+void VCodeBlockHighlightHelper::handleTextsHighlightResult(const QJsonArray &p_texts,
+                                                           const QJsonArray &p_results,
+                                                           int p_timeStamp)
 {
     int curStamp = m_timeStamp.load();
     // Abandon obsolete result.
     if (curStamp != p_timeStamp) {
         return;
     }
-    parseHighlightResult(p_timeStamp, p_id, p_html);
+
+    // All the code blocks of the batch, even if some of the results are
+    // missing or invalid.
+    QVector<int> ids;
+    for (auto const &val : p_texts) {
+        int idx = val.toObject()["id"].toInt(-1);
+        if (idx >= 0 && idx < m_codeBlocks.size()) {
+            ids.append(m_codeBlocks.at(idx).m_id);
+        }
+    }
+
+    QList<HLUnitPos> hlUnits;
+    for (auto const &val : p_results) {
+        QJsonObject obj = val.toObject();
+        int idx = obj["id"].toInt(-1);
+        if (idx < 0 || idx >= m_codeBlocks.size()) {
+            continue;
+        }
+
+        parseHighlightResult(idx, obj["html"].toString(), hlUnits);
+    }
+
+    m_highlighter->setCodeBlockHighlights(hlUnits, ids);
 }
 
-static void revertEscapedHtml(QString &p_html)
+// Get the character at @p_idx of @p_token into @p_ch, reverting the HTML
+// escape of '<', '>' and '&'. Return the length of it in @p_token.
+static int tokenCharAt(const QStringRef &p_token, int p_idx, QChar &p_ch)
 {
-    p_html.replace("&gt;", ">").replace("&lt;", "<").replace("&amp;", "&");
+    p_ch = p_token.at(p_idx);
+    if (p_ch != QChar('&')) {
+        return 1;
+    }
+
+    static const struct {
+        const char *m_entity;
+        int m_length;
+        char m_ch;
+    } entities[] = {
+        { "&gt;", 4, '>' },
+        { "&lt;", 4, '<' },
+        { "&amp;", 5, '&' }
+    };
+
+    for (auto const &entity : entities) {
+        if (p_token.mid(p_idx, entity.m_length) == QLatin1String(entity.m_entity)) {
+            p_ch = QChar(entity.m_ch);
+            return entity.m_length;
+        }
+    }
+
+    return 1;
 }
 
-// Search @p_tokenStr in @p_text from p_index. Spaces after `\n` will not make
-// a difference in the match. The matched range will be returned as
-// [@p_start, @p_end]. Update @p_index to @p_end + 1.
+// Match @p_token in @p_text at @p_index, walking both of them once. Spaces
+// after `\n` in @p_text, which may be removed in @p_token by unindenting,
+// will not make a difference in the match. The matched range will be
+// returned as [@p_start, @p_end]. Update @p_index to @p_end + 1.
 // Set @p_start and @p_end to -1 to indicate mismatch.
-static void matchTokenRelaxed(const QString &p_text, const QString &p_tokenStr,
+static void matchTokenRelaxed(const QString &p_text, const QStringRef &p_token,
                               int &p_index, int &p_start, int &p_end)
 {
-    QString regStr = QRegExp::escape(p_tokenStr);
-    // Do not replace the ending '\n'.
-    regStr.replace(QRegExp("\n(?!$)"), "\\s+");
-    QRegExp regExp(regStr);
-    p_start = p_text.indexOf(regExp, p_index);
+    int textLen = p_text.size();
+    int idx = p_index;
+    bool afterNewLine = idx > 0 && idx <= textLen && p_text[idx - 1] == QChar('\n');
+    p_start = -1;
+    for (int i = 0; i < p_token.size();) {
+        QChar ch;
+        int len = tokenCharAt(p_token, i, ch);
+        if (idx < textLen && p_text[idx] == ch) {
+            if (p_start == -1) {
+                p_start = idx;
+            }
+
+            afterNewLine = ch == QChar('\n')
+                           || (afterNewLine && (ch == QChar(' ') || ch == QChar('\t')));
+            ++idx;
+            i += len;
+        } else if (afterNewLine
+                   && idx < textLen
+                   && (p_text[idx] == QChar(' ') || p_text[idx] == QChar('\t'))) {
+            ++idx;
+        } else {
+            p_start = p_end = -1;
+            return;
+        }
+    }
+
     if (p_start == -1) {
-        p_end = -1;
-        return;
+        p_start = idx;
     }
 
-    p_end = p_start + regExp.matchedLength() - 1;
-    p_index = p_end + 1;
+    p_end = idx - 1;
+    p_index = idx;
 }
 
 // For now, we could only handle code blocks outside the list.
-void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
-                                                     int p_idx,
-                                                     const QString &p_html)
+bool VCodeBlockHighlightHelper::parseHighlightResult(int p_idx,
+                                                     const QString &p_html,
+                                                     QList<HLUnitPos> &p_units)
 {
     const VCodeBlock &block = m_codeBlocks.at(p_idx);
     int startPos = block.m_startPos;
@@ -138,12 +399,8 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
 
         while (xml.readNext()) {
             if (xml.isCharacters()) {
-                // Revert the HTML escape to match.
-                QString tokenStr = xml.text().toString();
-                revertEscapedHtml(tokenStr);
-
                 int start, end;
-                matchTokenRelaxed(text, tokenStr, textIndex, start, end);
+                matchTokenRelaxed(text, xml.text(), textIndex, start, end);
                 if (start == -1) {
                     failed = true;
                     goto exit;
@@ -172,21 +429,15 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
     }
 
 exit:
-    // Pass result back to highlighter.
-    int curStamp = m_timeStamp.load();
-    // Abandon obsolete result.
-    if (curStamp != p_timeStamp) {
-        return;
-    }
-
     if (xml.hasError() || failed) {
         qWarning() << "fail to parse highlighted result"
-                   << "stamp:" << p_timeStamp << "index:" << p_idx << p_html;
-        hlUnits.clear();
+                   << "index:" << p_idx << p_html;
+        return false;
     }
 
-    // We need to call this function anyway to trigger the rehighlight.
-    m_highlighter->setCodeBlockHighlights(hlUnits);
+    cacheHighlights(p_idx, hlUnits);
+    p_units.append(hlUnits);
+    return true;
 }
 
 bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
@@ -200,12 +451,8 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
 
     while (p_xml.readNext()) {
         if (p_xml.isCharacters()) {
-            // Revert the HTML escape to match.
-            QString tokenStr = p_xml.text().toString();
-            revertEscapedHtml(tokenStr);
-
             int start, end;
-            matchTokenRelaxed(p_text, tokenStr, p_index, start, end);
+            matchTokenRelaxed(p_text, p_xml.text(), p_index, start, end);
             if (start == -1) {
                 return false;
             }
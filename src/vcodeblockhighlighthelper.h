@@ -5,25 +5,42 @@
 #include <QList>
 #include <QAtomicInteger>
 #include <QXmlStreamReader>
+#include <QCache>
+#include <QVector>
+#include <QJsonArray>
+#include <QPointer>
 #include "vconfigmanager.h"
+#include "vcodeblockhighlightservice.h"
 
-class VDocument;
+class QWidget;
 
 class VCodeBlockHighlightHelper : public QObject
 {
     Q_OBJECT
 public:
+    // @p_editor: the editor of @p_highlighter, whose state decides the
+    // priority of its code blocks in VCodeBlockHighlightService.
     VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_highlighter,
-                              VDocument *p_vdoc, MarkdownConverterType p_type);
+                              const QWidget *p_editor);
+    ~VCodeBlockHighlightHelper();
+
+    // Priority of the code blocks to highlight in VCodeBlockHighlightService.
+    VCodeBlockHighlightService::Priority getPriority() const;
+
+    // Called by VCodeBlockHighlightService with results @p_results of a batch
+    // of texts @p_texts requested with @p_timeStamp.
+    void handleTextsHighlightResult(const QJsonArray &p_texts, const QJsonArray &p_results,
+                                    int p_timeStamp);
 
 signals:
 
 private slots:
     void handleCodeBlocksUpdated(const QList<VCodeBlock> &p_codeBlocks);
-    void handleTextHighlightResult(const QString &p_html, int p_id, int p_timeStamp);
 
 private:
-    void parseHighlightResult(int p_timeStamp, int p_idx, const QString &p_html);
+    // Parse the HTML of highlight.js @p_html of code block @p_idx and append
+    // the highlight units to @p_units. Return false if it fails.
+    bool parseHighlightResult(int p_idx, const QString &p_html, QList<HLUnitPos> &p_units);
 
     // @p_startPos: the global position of the start of the code block;
     // @p_text: the raw text of the code block;
@@ -39,11 +56,37 @@ private:
     // without any context.
     QString unindentCodeBlock(const QString &p_text);
 
+    // Key of the highlights of code block in @p_lang with @p_unindentedText.
+    static QByteArray cacheKey(const QString &p_lang, const QString &p_unindentedText);
+
+    // Get the cached highlights of code block @p_idx into @p_units, rebased
+    // to its position. Return false if they are not cached.
+    bool getCachedHighlights(int p_idx, QList<HLUnitPos> &p_units) const;
+
+    // Cache highlights @p_units of code block @p_idx.
+    void cacheHighlights(int p_idx, const QList<HLUnitPos> &p_units) const;
+
     HGMarkdownHighlighter *m_highlighter;
-    VDocument *m_vdocument;
-    MarkdownConverterType m_type;
+    const QWidget *m_editor;
+
+    // Shared by all the editors and owned by VNote, which may be destroyed
+    // before this helper.
+    QPointer<VCodeBlockHighlightService> m_service;
+
     QAtomicInteger<int> m_timeStamp;
     QList<VCodeBlock> m_codeBlocks;
+
+    // Unindented text and cache key of each code block of m_codeBlocks.
+    QVector<QString> m_unindentedTexts;
+    QVector<QByteArray> m_cacheKeys;
+
+    // Highlights of code blocks with positions relative to their unindented
+    // text, shared by all the editors. The cost of an entry is the number of
+    // its units.
+    static QCache<QByteArray, QVector<HLUnitPos> > s_cache;
+
+    // Max number of units in s_cache.
+    static const int c_cacheMaxUnits;
 };
 
 #endif // VCODEBLOCKHIGHLIGHTHELPER_H
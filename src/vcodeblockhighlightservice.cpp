@@ -0,0 +1,210 @@
+#include "vcodeblockhighlightservice.h"
+
+#include <QDebug>
+#include <QWebChannel>
+#include <QWebEnginePage>
+#include <QJsonObject>
+#include "vdocument.h"
+#include "vcodeblockhighlighthelper.h"
+#include "utils/vutils.h"
+
+const int VCodeBlockHighlightService::c_maxBatchLength = 32 * 1024;
+
+VCodeBlockHighlightService::VCodeBlockHighlightService(QObject *p_parent)
+    : QObject(p_parent), m_pageReady(false), m_busy(false), m_batchId(0),
+      m_batchClient(NULL), m_batchTimeStamp(0)
+{
+    m_page = new QWebEnginePage(this);
+    m_document = new VDocument(NULL, this);
+
+    QWebChannel *channel = new QWebChannel(this);
+    channel->registerObject(QStringLiteral("content"), m_document);
+    m_page->setWebChannel(channel);
+
+    connect(m_document, &VDocument::readyToHighlightText,
+            this, &VCodeBlockHighlightService::handlePageReady);
+    connect(m_document, &VDocument::textsHighlighted,
+            this, &VCodeBlockHighlightService::handleTextsHighlightResult);
+    connect(m_page, &QWebEnginePage::renderProcessTerminated,
+            this, &VCodeBlockHighlightService::handleRenderProcessTerminated);
+
+    m_page->setHtml(VUtils::readFileFromDisk(":/resources/code_block_highlight.html"),
+                    QUrl("qrc:/resources/code_block_highlight.html"));
+}
+
+void VCodeBlockHighlightService::highlightTexts(VCodeBlockHighlightHelper *p_client,
+                                                const QJsonArray &p_texts,
+                                                int p_timeStamp)
+{
+    cancel(p_client, p_timeStamp);
+
+    if (!p_texts.isEmpty()) {
+        Job job;
+        job.m_client = p_client;
+        job.m_timeStamp = p_timeStamp;
+        job.m_texts = p_texts;
+        job.m_next = 0;
+        m_jobs.append(job);
+    }
+
+    dispatch();
+}
+
+void VCodeBlockHighlightService::cancel(const VCodeBlockHighlightHelper *p_client,
+                                        int p_timeStamp)
+{
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        const Job &job = m_jobs[i];
+        if (job.m_client == p_client && job.m_timeStamp < p_timeStamp) {
+            m_jobs.removeAt(i);
+        }
+    }
+
+    // The page could not be interrupted. Just abandon the result.
+    if (m_busy && m_batchClient == p_client && m_batchTimeStamp < p_timeStamp) {
+        m_batchClient = NULL;
+    }
+}
+
+void VCodeBlockHighlightService::removeClient(const VCodeBlockHighlightHelper *p_client)
+{
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        if (m_jobs[i].m_client == p_client) {
+            m_jobs.removeAt(i);
+        }
+    }
+
+    if (m_batchClient == p_client) {
+        m_batchClient = NULL;
+    }
+}
+
+void VCodeBlockHighlightService::handlePageReady()
+{
+    m_pageReady = true;
+    dispatch();
+}
+
+void VCodeBlockHighlightService::handleRenderProcessTerminated()
+{
+    qWarning() << "render process of code block highlight page terminated";
+
+    // The batch being highlighted is lost. Put it back to the front of the
+    // job of its client, which will be sent once the page is ready again.
+    if (m_busy && m_batchClient) {
+        int idx = -1;
+        for (int i = 0; i < m_jobs.size(); ++i) {
+            if (m_jobs[i].m_client == m_batchClient) {
+                idx = i;
+                break;
+            }
+        }
+
+        if (idx == -1) {
+            Job job;
+            job.m_client = m_batchClient;
+            job.m_timeStamp = m_batchTimeStamp;
+            job.m_next = 0;
+            m_jobs.prepend(job);
+            idx = 0;
+        }
+
+        // A job of the client could only be the rest of the lost batch,
+        // since a newer one would have dropped the batch.
+        Job &job = m_jobs[idx];
+        Q_ASSERT(job.m_timeStamp == m_batchTimeStamp);
+        QJsonArray texts = m_batchTexts;
+        for (int i = job.m_next; i < job.m_texts.size(); ++i) {
+            texts.append(job.m_texts.at(i));
+        }
+
+        job.m_texts = texts;
+        job.m_next = 0;
+    }
+
+    m_pageReady = false;
+    m_busy = false;
+    m_batchClient = NULL;
+    m_batchTexts = QJsonArray();
+
+    m_page->setHtml(VUtils::readFileFromDisk(":/resources/code_block_highlight.html"),
+                    QUrl("qrc:/resources/code_block_highlight.html"));
+}
+
+int VCodeBlockHighlightService::nextJob() const
+{
+    int idx = -1;
+    int priority = Background + 1;
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        int pri = m_jobs[i].m_client->getPriority();
+        if (pri < priority) {
+            idx = i;
+            priority = pri;
+            if (priority == Focused) {
+                break;
+            }
+        }
+    }
+
+    return idx;
+}
+
+void VCodeBlockHighlightService::dispatch()
+{
+    if (!m_pageReady || m_busy) {
+        return;
+    }
+
+    int idx = nextJob();
+    if (idx == -1) {
+        return;
+    }
+
+    Job &job = m_jobs[idx];
+    QJsonArray texts;
+    int length = 0;
+    while (job.m_next < job.m_texts.size()) {
+        QJsonValue text = job.m_texts.at(job.m_next);
+        int len = text.toObject()["text"].toString().size();
+        if (!texts.isEmpty() && length + len > c_maxBatchLength) {
+            break;
+        }
+
+        texts.append(text);
+        length += len;
+        ++job.m_next;
+    }
+
+    m_busy = true;
+    ++m_batchId;
+    m_batchClient = job.m_client;
+    m_batchTimeStamp = job.m_timeStamp;
+    m_batchTexts = texts;
+
+    if (job.m_next == job.m_texts.size()) {
+        m_jobs.removeAt(idx);
+    }
+
+    m_document->highlightTextsAsync(texts, m_batchId);
+}
+
+void VCodeBlockHighlightService::handleTextsHighlightResult(const QJsonArray &p_results,
+                                                            int p_batchId)
+{
+    // Result of a batch sent before the page is reloaded.
+    if (!m_busy || p_batchId != m_batchId) {
+        return;
+    }
+
+    m_busy = false;
+
+    VCodeBlockHighlightHelper *client = m_batchClient;
+    QJsonArray texts = m_batchTexts;
+    m_batchClient = NULL;
+    m_batchTexts = QJsonArray();
+    if (client) {
+        client->handleTextsHighlightResult(texts, p_results, m_batchTimeStamp);
+    }
+
+    dispatch();
+}
@@ -0,0 +1,104 @@
+#ifndef VCODEBLOCKHIGHLIGHTSERVICE_H
+#define VCODEBLOCKHIGHLIGHTSERVICE_H
+
+#include <QObject>
+#include <QList>
+#include <QJsonArray>
+
+class QWebEnginePage;
+class VDocument;
+class VCodeBlockHighlightHelper;
+
+// Highlight code blocks of all the editors with highlight.js in one hidden
+// web page, so that edit mode does not depend on the read mode page of each
+// tab. Requests of editors are queued as jobs and sent to the page batch by
+// batch. Jobs of the focused editor go first, then those of other visible
+// editors, and those of background tabs go last.
+class VCodeBlockHighlightService : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VCodeBlockHighlightService(QObject *p_parent = 0);
+
+    // Priority of the job of an editor. Smaller one goes first.
+    enum Priority
+    {
+        // The editor has focus.
+        Focused = 0,
+
+        // The editor is visible, such as the one in another split window.
+        Visible,
+
+        // The editor is hidden, such as the one in a background tab.
+        Background
+    };
+
+    // Queue texts @p_texts of @p_client with time stamp @p_timeStamp.
+    // Texts of @p_client queued before will be replaced.
+    // @p_texts: array of objects {"id": int, "text": string}. Results will be
+    // passed to VCodeBlockHighlightHelper::handleTextsHighlightResult() of
+    // @p_client batch by batch, tagged with @p_timeStamp.
+    void highlightTexts(VCodeBlockHighlightHelper *p_client,
+                        const QJsonArray &p_texts, int p_timeStamp);
+
+    // Drop texts of @p_client with time stamp older than @p_timeStamp, both
+    // queued ones and the ones being highlighted.
+    void cancel(const VCodeBlockHighlightHelper *p_client, int p_timeStamp);
+
+    // Drop all the texts of @p_client, which is about to be destroyed.
+    void removeClient(const VCodeBlockHighlightHelper *p_client);
+
+private slots:
+    void handlePageReady();
+    void handleTextsHighlightResult(const QJsonArray &p_results, int p_batchId);
+
+    // The render process of m_page is gone. Reload the page and queue the
+    // batch being highlighted again.
+    void handleRenderProcessTerminated();
+
+private:
+    // Texts of a client to highlight.
+    struct Job
+    {
+        VCodeBlockHighlightHelper *m_client;
+        int m_timeStamp;
+        QJsonArray m_texts;
+
+        // Index in m_texts of the first text not sent yet.
+        int m_next;
+    };
+
+    // Send a batch of texts of the job with the highest priority to the
+    // page if it is idle.
+    void dispatch();
+
+    // Index in m_jobs of the job to send next. -1 if there is none.
+    int nextJob() const;
+
+    QWebEnginePage *m_page;
+
+    // Registered on the web channel of m_page as "content".
+    VDocument *m_document;
+
+    // Whether m_page has been loaded and could accept a batch.
+    bool m_pageReady;
+
+    // At most one job for each client, in the order they are queued.
+    QList<Job> m_jobs;
+
+    // Whether m_page is highlighting a batch.
+    bool m_busy;
+
+    // The batch being highlighted in m_page. m_batchClient is NULL if the
+    // client has dropped it.
+    int m_batchId;
+    VCodeBlockHighlightHelper *m_batchClient;
+    int m_batchTimeStamp;
+    QJsonArray m_batchTexts;
+
+    // Max total length of the texts of a batch, so that a large job of a
+    // background tab will not hold the page for long.
+    static const int c_maxBatchLength;
+};
+
+#endif // VCODEBLOCKHIGHLIGHTSERVICE_H
@@ -65,14 +65,14 @@ void VDocument::keyPressEvent(int p_key, bool p_ctrl, bool p_shift)
     emit keyPressed(p_key, p_ctrl, p_shift);
 }
 
-void VDocument::highlightTextAsync(const QString &p_text, int p_id, int p_timeStamp)
+void VDocument::highlightTextsAsync(const QJsonArray &p_texts, int p_timeStamp)
 {
-    emit requestHighlightText(p_text, p_id, p_timeStamp);
+    emit requestHighlightTexts(p_texts, p_timeStamp);
 }
 
-void VDocument::highlightTextCB(const QString &p_html, int p_id, int p_timeStamp)
+void VDocument::highlightTextsCB(const QJsonArray &p_results, int p_timeStamp)
 {
-    emit textHighlighted(p_html, p_id, p_timeStamp);
+    emit textsHighlighted(p_results, p_timeStamp);
 }
 
 void VDocument::noticeReadyToHighlightText()
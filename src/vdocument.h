@@ -3,6 +3,7 @@
 
 #include <QObject>
 #include <QString>
+#include <QJsonArray>
 
 class VFile;
 
@@ -19,9 +20,10 @@ public:
     QString getToc();
     void scrollToAnchor(const QString &anchor);
     void setHtml(const QString &html);
-    // Request to highlight a segment text.
-    // Use p_id to identify the result.
-    void highlightTextAsync(const QString &p_text, int p_id, int p_timeStamp);
+    // Request to highlight segment texts in one batch.
+    // @p_texts: array of objects {"id": int, "text": string}. Use the id to
+    // identify the result.
+    void highlightTextsAsync(const QJsonArray &p_texts, int p_timeStamp);
 
     void setFile(const VFile *p_file);
 
@@ -40,7 +42,11 @@ public slots:
     void setLog(const QString &p_log);
     void keyPressEvent(int p_key, bool p_ctrl, bool p_shift);
     void updateText();
-    void highlightTextCB(const QString &p_html, int p_id, int p_timeStamp);
+
+    // @p_results: array of objects {"id": int, "html": string}, one for each
+    // text of the request.
+    void highlightTextsCB(const QJsonArray &p_results, int p_timeStamp);
+
     void noticeReadyToHighlightText();
 
     // Web-side handle logics (MathJax etc.) is finished.
@@ -55,8 +61,8 @@ signals:
     void htmlChanged(const QString &html);
     void logChanged(const QString &p_log);
     void keyPressed(int p_key, bool p_ctrl, bool p_shift);
-    void requestHighlightText(const QString &p_text, int p_id, int p_timeStamp);
-    void textHighlighted(const QString &p_html, int p_id, int p_timeStamp);
+    void requestHighlightTexts(const QJsonArray &p_texts, int p_timeStamp);
+    void textsHighlighted(const QJsonArray &p_results, int p_timeStamp);
     void readyToHighlightText();
     void logicsFinished();
 
@@ -13,8 +13,7 @@
 extern VConfigManager vconfig;
 extern VNote *g_vnote;
 
-VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
-                 QWidget *p_parent)
+VMdEdit::VMdEdit(VFile *p_file, QWidget *p_parent)
     : VEdit(p_file, p_parent), m_mdHighlighter(NULL)
 {
     V_ASSERT(p_file->getDocType() == DocType::Markdown);
@@ -26,8 +25,7 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
     connect(m_mdHighlighter, &HGMarkdownHighlighter::highlightCompleted,
             this, &VMdEdit::generateEditOutline);
 
-    m_cbHighlighter = new VCodeBlockHighlightHelper(m_mdHighlighter, p_vdoc,
-                                                    p_type);
+    m_cbHighlighter = new VCodeBlockHighlightHelper(m_mdHighlighter, this);
 
     m_imagePreviewer = new VImagePreviewer(this, 500);
 
@@ -43,6 +41,13 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
     connect(QApplication::clipboard(), &QClipboard::changed,
             this, &VMdEdit::handleClipboardChanged);
 
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &VMdEdit::updateVisibleBlockRange);
+    // Edits could shift the block numbers without scrolling. Queued until the
+    // layout is updated.
+    connect(document(), &QTextDocument::blockCountChanged,
+            this, &VMdEdit::updateVisibleBlockRange, Qt::QueuedConnection);
+
     m_editOps->updateTabSettings();
     updateFontAndPalette();
 }
@@ -437,6 +442,16 @@ void VMdEdit::resizeEvent(QResizeEvent *p_event)
     m_imagePreviewer->update();
 
     VEdit::resizeEvent(p_event);
+
+    updateVisibleBlockRange();
+}
+
+void VMdEdit::updateVisibleBlockRange()
+{
+    QRect rect = viewport()->rect();
+    int first = cursorForPosition(rect.topLeft()).block().blockNumber();
+    int last = cursorForPosition(rect.bottomRight()).block().blockNumber();
+    m_mdHighlighter->setVisibleBlockRange(first, last);
 }
 
 const QVector<VHeader> &VMdEdit::getHeaders() const
@@ -14,15 +14,13 @@
 
 class HGMarkdownHighlighter;
 class VCodeBlockHighlightHelper;
-class VDocument;
 class VImagePreviewer;
 
 class VMdEdit : public VEdit
 {
     Q_OBJECT
 public:
-    VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
-            QWidget *p_parent = 0);
+    VMdEdit(VFile *p_file, QWidget *p_parent = 0);
     void beginEdit() Q_DECL_OVERRIDE;
     void endEdit() Q_DECL_OVERRIDE;
     void saveFile() Q_DECL_OVERRIDE;
@@ -57,6 +55,9 @@ private slots:
     void handleSelectionChanged();
     void handleClipboardChanged(QClipboard::Mode p_mode);
 
+    // Update the range of visible blocks to the highlighter.
+    void updateVisibleBlockRange();
+
 protected:
     void keyPressEvent(QKeyEvent *event) Q_DECL_OVERRIDE;
     bool canInsertFromMimeData(const QMimeData *source) const Q_DECL_OVERRIDE;
@@ -45,7 +45,7 @@ void VMdTab::setupUI()
     setupMarkdownViewer();
 
     if (m_file->isModifiable()) {
-        m_editor = new VMdEdit(m_file, m_document, m_mdConType, this);
+        m_editor = new VMdEdit(m_file, this);
         connect(dynamic_cast<VMdEdit *>(m_editor), &VMdEdit::headersChanged,
                 this, &VMdTab::updateTocFromHeaders);
         connect(dynamic_cast<VMdEdit *>(m_editor), &VMdEdit::statusChanged,
@@ -12,6 +12,7 @@
 #include "vconfigmanager.h"
 #include "vmainwindow.h"
 #include "vorphanfile.h"
+#include "vcodeblockhighlightservice.h"
 
 extern VConfigManager vconfig;
 
@@ -38,7 +39,8 @@ const QString VNote::c_shortcutsDocFile_en = ":/resources/docs/shortcuts_en.md";
 const QString VNote::c_shortcutsDocFile_zh = ":/resources/docs/shortcuts_zh.md";
 
 VNote::VNote(QObject *parent)
-    : QObject(parent), m_mainWindow(dynamic_cast<VMainWindow *>(parent))
+    : QObject(parent), m_mainWindow(dynamic_cast<VMainWindow *>(parent)),
+      m_codeBlockHighlightService(NULL)
 {
     initTemplate();
     vconfig.getNotebooks(m_notebooks, this);
@@ -276,3 +278,12 @@ VFile *VNote::getOrphanFile(const QString &p_path)
     m_externalFiles.append(file);
     return file;
 }
+
+VCodeBlockHighlightService *VNote::getCodeBlockHighlightService()
+{
+    if (!m_codeBlockHighlightService) {
+        m_codeBlockHighlightService = new VCodeBlockHighlightService(this);
+    }
+
+    return m_codeBlockHighlightService;
+}
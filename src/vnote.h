@@ -15,6 +15,7 @@
 
 class VMainWindow;
 class VFile;
+class VCodeBlockHighlightService;
 
 class VNote : public QObject
 {
@@ -70,6 +71,10 @@ public:
     // Given the path of an external file, create a VFile struct.
     VFile *getOrphanFile(const QString &p_path);
 
+    // Get the service to highlight code blocks of all the editors, which is
+    // created on first use.
+    VCodeBlockHighlightService *getCodeBlockHighlightService();
+
 public slots:
     void updateTemplate();
 
@@ -84,6 +89,8 @@ private:
     // Hold all external file: Orphan File.
     // Need to clean up periodly.
     QList<VFile *> m_externalFiles;
+
+    VCodeBlockHighlightService *m_codeBlockHighlightService;
 };
 
 inline const QVector<QPair<QString, QString> >& VNote::getPalette() const